@@ -1,5 +1,9 @@
 #include "ps3eye.hpp"
 #include "mgr.hpp"
+#include "replay.hpp"
+
+#include <algorithm>
+#include <mutex>
 
 using ps3eye::detail::usb_manager;
 using ps3eye::detail::_ps3eye_debug_status;
@@ -7,19 +11,104 @@ using ps3eye::detail::ps3eye_debug;
 
 namespace ps3eye {
 
+bool camera::auto_gain() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return auto_gain_;
+}
+
+bool camera::awb() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return awb_;
+}
+
+uint8_t camera::gain() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return gain_;
+}
+
+uint8_t camera::exposure() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return exposure_;
+}
+
+uint8_t camera::sharpness() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return sharpness_;
+}
+
+uint8_t camera::contrast() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return contrast_;
+}
+
+uint8_t camera::brightness() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return brightness_;
+}
+
+uint8_t camera::hue() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return hue_;
+}
+
+uint8_t camera::red_balance() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return red_balance_;
+}
+
+uint8_t camera::blue_balance() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return blue_balance_;
+}
+
+uint8_t camera::green_balance() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return green_balance_;
+}
+
+std::pair<bool, bool> camera::flip_status() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return { flip_h_, flip_v_ };
+}
+
+bool camera::test_pattern_status() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return test_pattern_;
+}
+
+int camera::saturation() const
+{
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    return saturation_;
+}
+
 void camera::set_auto_gain(bool val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     auto_gain_ = val;
     constexpr int mask = 1 << 0 /* AEC */ | 1 << 2 /* AGC */;
     if (val)
     {
-        sccb_reg_write(0x13, sccb_reg_read(0x13) | mask);
-        sccb_reg_write(0x64, sccb_reg_read(0x64) | 0x03);
+        sccb_reg_write(0x13, sccb_reg_cached(0x13) | mask);
+        sccb_reg_write(0x64, sccb_reg_cached(0x64) | 0x03);
     }
     else
     {
-        sccb_reg_write(0x13, sccb_reg_read(0x13) & ~mask);
-        sccb_reg_write(0x64, sccb_reg_read(0x64) & ~0x03);
+        sccb_reg_write(0x13, sccb_reg_cached(0x13) & ~mask);
+        sccb_reg_write(0x64, sccb_reg_cached(0x64) & ~0x03);
 
         set_gain(gain_);
         set_exposure(exposure_);
@@ -28,17 +117,18 @@ void camera::set_auto_gain(bool val)
 
 void camera::set_awb(bool val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     awb_ = val;
 
     if (val)
     {
-        sccb_reg_write(0x13, sccb_reg_read(0x13) | 0x02);
-        sccb_reg_write(0x63, sccb_reg_read(0x63) | 0xc0);
+        sccb_reg_write(0x13, sccb_reg_cached(0x13) | 0x02);
+        sccb_reg_write(0x63, sccb_reg_cached(0x63) | 0xc0);
     }
     else
     {
-        sccb_reg_write(0x13, sccb_reg_read(0x13) & ~0x02);
-        sccb_reg_write(0x63, sccb_reg_read(0x63) & ~0xc0);
+        sccb_reg_write(0x13, sccb_reg_cached(0x13) & ~0x02);
+        sccb_reg_write(0x63, sccb_reg_cached(0x63) & ~0xc0);
 
         set_red_balance(red_balance_);
         set_green_balance(green_balance_);
@@ -46,6 +136,53 @@ void camera::set_awb(bool val)
     }
 }
 
+ps3eye::detail::control_queue& camera::controls()
+{
+    std::call_once(controls_once_, [this] {
+        controls_ = std::make_unique<ps3eye::detail::control_queue>(&camera::apply_control, this);
+    });
+    return *controls_;
+}
+
+int camera::apply_control(void* data, control c, int value)
+{
+    camera& cam = *static_cast<camera*>(data);
+    std::lock_guard<std::recursive_mutex> lock(cam.control_mutex_);
+
+    switch (c)
+    {
+    case control::auto_gain: cam.set_auto_gain(value != 0); break;
+    case control::awb: cam.set_awb(value != 0); break;
+    case control::gain: cam.set_gain(value); break;
+    case control::exposure: cam.set_exposure(value); break;
+    case control::sharpness: cam.set_sharpness(value); break;
+    case control::contrast: cam.set_contrast(value); break;
+    case control::brightness: cam.set_brightness(value); break;
+    case control::hue: cam.set_hue(value); break;
+    case control::red_balance: cam.set_red_balance(value); break;
+    case control::blue_balance: cam.set_blue_balance(value); break;
+    case control::green_balance: cam.set_green_balance(value); break;
+    case control::saturation: cam.set_saturation(value); break;
+    case control::flip: cam.set_flip_status(value & 1, value & 2); break;
+    case control::test_pattern: cam.set_test_pattern_status(value != 0); break;
+    }
+
+    return cam.error_code_;
+}
+
+std::future<int> camera::set_control_async(control c, int value)
+{
+    std::promise<int> promise;
+    std::future<int> ret = promise.get_future();
+    controls().post(c, value, &promise, nullptr);
+    return ret;
+}
+
+void camera::set_control_async(control c, int value, std::function<void(int error)> done)
+{
+    controls().post(c, value, nullptr, std::move(done));
+}
+
 void camera::set_framerate(int val)
 {
     if (!streaming_)
@@ -56,8 +193,9 @@ void camera::set_framerate(int val)
 
 void camera::set_test_pattern_status(bool enable)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     test_pattern_ = enable;
-    uint8_t val = sccb_reg_read(0x0C);
+    uint8_t val = sccb_reg_cached(0x0C);
     val &= ~0b00000001;
     if (test_pattern_) val |= 0b00000001; // 0x80;
     sccb_reg_write(0x0C, val);
@@ -65,6 +203,7 @@ void camera::set_test_pattern_status(bool enable)
 
 void camera::set_exposure(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     exposure_ = val;
     sccb_reg_write(0x08, exposure_ >> 7);
     sccb_reg_write(0x10, uint8_t(exposure_ << 1));
@@ -72,6 +211,7 @@ void camera::set_exposure(int val)
 
 void camera::set_sharpness(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     sharpness_ = val;
     sccb_reg_write(0x91, sharpness_); // vga noise
     sccb_reg_write(0x8E, sharpness_); // qvga noise
@@ -79,45 +219,52 @@ void camera::set_sharpness(int val)
 
 void camera::set_contrast(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     contrast_ = val;
     sccb_reg_write(0x9C, contrast_);
 }
 
 void camera::set_brightness(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     brightness_ = val;
     sccb_reg_write(0x9B, brightness_);
 }
 
 void camera::set_hue(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     hue_ = val;
     sccb_reg_write(0x01, (uint8_t)hue_);
 }
 
 void camera::set_red_balance(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     red_balance_ = val;
     sccb_reg_write(0x43, red_balance_);
 }
 
 void camera::set_blue_balance(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     blue_balance_ = val;
     sccb_reg_write(0x42, blue_balance_);
 }
 
 void camera::set_green_balance(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     green_balance_ = val;
     sccb_reg_write(0x44, green_balance_);
 }
 
 void camera::set_flip_status(bool horizontal, bool vertical)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     flip_h_ = horizontal;
     flip_v_ = vertical;
-    uint8_t val = sccb_reg_read(0x0c);
+    uint8_t val = sccb_reg_cached(0x0c);
     val &= ~0xc0;
     if (!horizontal) val |= 0x40;
     if (!vertical) val |= 0x80;
@@ -126,6 +273,7 @@ void camera::set_flip_status(bool horizontal, bool vertical)
 
 void camera::set_gain(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     gain_ = val;
     val = gain_;
     switch (val & 0x30)
@@ -151,11 +299,60 @@ void camera::set_gain(int val)
 
 void camera::set_saturation(int val)
 {
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
     saturation_ = val;
     sccb_reg_write(0xa7, saturation_); /* U saturation */
     sccb_reg_write(0xa8, saturation_); /* V saturation */
 }
 
+int camera::debayer_threads() const
+{
+    return (int)urb.queue.debayer_threads();
+}
+
+void camera::set_debayer_threads(int n)
+{
+    urb.queue.set_debayer_threads((unsigned)std::max(1, n));
+}
+
+void camera::set_frame_queue_depth(int n)
+{
+    queue_depth_ = std::clamp(n, (int)ps3eye::detail::frame_queue::min_depth,
+                              (int)ps3eye::detail::frame_queue::max_depth);
+}
+
+void camera::set_usb_transfers(int count, int size)
+{
+    transfer_count_ = std::max(0, count);
+    transfer_size_ = std::max(0, size);
+}
+
+void camera::set_frame_memory(uint8_t* memory, size_t size)
+{
+    frame_memory_ = memory;
+    frame_memory_size_ = memory ? size : 0;
+}
+
+void camera::set_callback_threads(int n)
+{
+    ps3eye::detail::delivery_pool::instance().set_threads((unsigned)std::max(0, n));
+}
+
+bool camera::set_event_threads(const event_thread_config& config)
+{
+    return usb_manager::instance().set_event_threads(config);
+}
+
+capture_stats camera::stats()
+{
+    return urb.queue.counters().snapshot();
+}
+
+void camera::set_recording(const char* path)
+{
+    recording_path_ = path ? path : "";
+}
+
 void camera::set_debug(bool value)
 {
     usb_manager::instance().set_debug(value);
@@ -163,6 +360,14 @@ void camera::set_debug(bool value)
 }
 
 std::pair<int, int> camera::size() const
+{
+    auto [ w, h ] = sensor_size();
+    if (scale_ == output_scale::half)
+        return { w / 2, h / 2 };
+    return { w, h };
+}
+
+std::pair<int, int> camera::sensor_size() const
 {
     switch (resolution_)
     {
@@ -179,4 +384,9 @@ std::vector<std::shared_ptr<camera>> list_devices()
     return usb_manager::instance().list_devices();
 }
 
+std::shared_ptr<camera> open_replay(const char* path, replay_rate rate, bool loop)
+{
+    return std::make_shared<camera>(std::make_unique<ps3eye::detail::replay_transport>(path, rate, loop));
+}
+
 } // ns ps3eye
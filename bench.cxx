@@ -0,0 +1,329 @@
+#include "urb.hpp"
+#include "queue.hpp"
+#include "debayer.hpp"
+#include "delivery.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace ps3eye::detail;
+using ps3eye::capture_stats;
+using ps3eye::format;
+using ps3eye::output_scale;
+using ps3eye::frame_metadata;
+
+// Throughput of the hardware-independent parts of the driver on synthetic
+// data. Prints one CSV row per benchmark, times are per frame.
+
+using clock_ = std::chrono::steady_clock;
+
+static unsigned iterations = 500;
+
+static void print_header()
+{
+    printf("bench,variant,width,height,iterations,ns_per_frame,mb_per_s,p50_ns,p90_ns,p99_ns,max_ns\n");
+}
+
+static unsigned warmup() { return std::max(1u, iterations / 10); }
+
+static void report(const char* bench, const char* variant, int W, int H, size_t bytes_per_frame,
+                   std::vector<double> ns)
+{
+    double total = 0;
+    for (double x : ns)
+        total += x;
+    std::sort(ns.begin(), ns.end());
+
+    auto pct = [&](double p) { return ns[std::min(ns.size() - 1, size_t(p * (double)ns.size()))]; };
+    double mean = total / (double)ns.size();
+
+    printf("%s,%s,%d,%d,%u,%.0f,%.1f,%.0f,%.0f,%.0f,%.0f\n",
+           bench, variant, W, H, iterations, mean, (double)bytes_per_frame / mean * 1e3,
+           pct(.5), pct(.9), pct(.99), ns.back());
+    fflush(stdout);
+}
+
+// fn is called once per iteration and returns the time it took in ns, so
+// that setup between iterations doesn't count.
+template<typename F>
+static void measure(const char* bench, const char* variant, int W, int H, size_t bytes_per_frame, F&& fn)
+{
+    for (unsigned i = 0; i < warmup(); i++)
+        (void)fn();
+
+    std::vector<double> ns(iterations);
+    for (double& x : ns)
+        x = fn();
+    report(bench, variant, W, H, bytes_per_frame, std::move(ns));
+}
+
+template<typename F>
+static double time_ns(F&& fn)
+{
+    auto t = clock_::now();
+    fn();
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(clock_::now() - t).count();
+}
+
+// One frame as the bridge sends it: 2048-byte bulk payloads, each with a
+// 12-byte UVC header, packed into transfers of up to transfer_size.
+static std::vector<std::vector<uint8_t>> make_stream(const std::vector<uint8_t>& frame, uint32_t pts, bool fid)
+{
+    constexpr unsigned payload_size = 2048, header_size = 12;
+    std::vector<std::vector<uint8_t>> transfers(1);
+
+    for (size_t pos = 0; pos < frame.size(); )
+    {
+        size_t len = std::min<size_t>(payload_size - header_size, frame.size() - pos);
+        bool eof = pos + len == frame.size();
+
+        if (transfers.back().size() + payload_size > urb_descriptor::default_transfer_size)
+            transfers.emplace_back();
+        std::vector<uint8_t>& xfer = transfers.back();
+
+        const uint8_t header[header_size] = {
+            header_size, uint8_t(1 << 2 | (eof ? 1 << 1 : 0) | fid), // PTS, EOF, FID
+            uint8_t(pts), uint8_t(pts >> 8), uint8_t(pts >> 16), uint8_t(pts >> 24),
+        };
+        xfer.insert(xfer.end(), header, header + header_size);
+        xfer.insert(xfer.end(), frame.begin() + (ptrdiff_t)pos, frame.begin() + (ptrdiff_t)(pos + len));
+        pos += len;
+    }
+
+    return transfers;
+}
+
+static std::vector<uint8_t> random_frame(int W, int H)
+{
+    std::mt19937 rng(0x4245);
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::vector<uint8_t> frame(unsigned(W * H));
+    for (uint8_t& x : frame)
+        x = (uint8_t)dist(rng);
+    return frame;
+}
+
+static void bench_parse(int W, int H)
+{
+    const auto frame = random_frame(W, H);
+    // alternate FID and PTS like the camera does
+    const std::vector<std::vector<uint8_t>> streams[2] = {
+        make_stream(frame, 1000, false), make_stream(frame, 2000, true),
+    };
+    size_t wire_bytes = 0;
+    for (const auto& xfer : streams[0])
+        wire_bytes += xfer.size();
+
+    auto urb = std::make_unique<urb_descriptor>();
+    urb->begin(unsigned(W * H));
+    auto now = clock_::now();
+    unsigned n = 0;
+
+    // Copies of the transfers, pkt_scan() takes them non-const.
+    auto transfers = streams[0];
+    measure("parse", "pkt_scan", W, H, wire_bytes, [&] {
+        transfers = streams[n++ % 2];
+        return time_ns([&] {
+            for (auto& xfer : transfers)
+                urb->pkt_scan(xfer.data(), (int)xfer.size(), now);
+        });
+    });
+
+    capture_stats stats = urb->queue.counters().snapshot();
+    if (stats.frames_completed == 0 || stats.frames_incomplete || stats.payloads_bad_header)
+    {
+        fprintf(stderr, "parse: bad synthetic stream\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void bench_queue(int W, int H)
+{
+    const auto frame = random_frame(W, H);
+    const size_t size = frame.size();
+    auto queue = std::make_unique<frame_queue>();
+    queue->init(unsigned(size));
+    std::vector<uint8_t> dest(size);
+    frame_metadata meta;
+
+    measure("queue", "enqueue", W, H, size, [&] {
+        double ns = time_ns([&] { (void)queue->enqueue(meta); });
+        (void)queue->dequeue(dest.data(), W, H, frame_output{ format::Bayer, W });
+        return ns;
+    });
+
+    measure("queue", "dequeue", W, H, size, [&] {
+        (void)queue->enqueue(meta);
+        return time_ns([&] { (void)queue->dequeue(dest.data(), W, H, frame_output{ format::Bayer, W }); });
+    });
+
+    measure("queue", "acquire", W, H, size, [&] {
+        (void)queue->enqueue(meta);
+        return time_ns([&] {
+            (void)queue->acquire(meta);
+            queue->release();
+        });
+    });
+}
+
+// Time from enqueue() until the consumer has the frame, for each way of
+// waiting for it. Frames come 1 ms apart so that the consumer is idle.
+static void bench_wakeup(int W, int H)
+{
+    using namespace std::chrono;
+    const unsigned size = unsigned(W * H);
+    const unsigned total = warmup() + iterations;
+
+    enum mode { blocking, polling, callback };
+    static const char* const names[] = { "get_frame", "poll-1ms", "callback" };
+
+    for (mode m : { blocking, polling, callback })
+    {
+        auto queue = std::make_unique<frame_queue>();
+        queue->init(size);
+        std::vector<uint8_t> dest(size);
+        std::vector<double> ns;
+        ns.reserve(total);
+
+        auto receive = [&] {
+            frame_metadata meta;
+            auto timeout = m == blocking ? frame_queue::default_timeout : microseconds::zero();
+            bool ok = false;
+            while (queue->dequeue(dest.data(), W, H, frame_output{ format::Bayer, W }, &meta, timeout))
+            {
+                ns.push_back((double)duration_cast<nanoseconds>(clock_::now() - meta.timestamp).count());
+                ok = true;
+            }
+            return ok;
+        };
+
+        std::atomic_bool done = false;
+        std::thread consumer;
+        delivery_task task(+[](void* fn) { (*static_cast<decltype(receive)*>(fn))(); }, &receive);
+
+        if (m == callback)
+            queue->set_frame_hook([](void* task) {
+                delivery_pool::instance().post(*static_cast<delivery_task*>(task));
+            }, &task);
+        else
+            consumer = std::thread([&] {
+                while (!done.load(std::memory_order_relaxed))
+                    if (!receive() && m == polling)
+                        std::this_thread::sleep_for(1ms);
+            });
+
+        frame_metadata meta;
+        for (unsigned i = 0; i < total; i++)
+        {
+            std::this_thread::sleep_for(1ms);
+            meta.timestamp = clock_::now();
+            (void)queue->enqueue(meta);
+        }
+        std::this_thread::sleep_for(20ms);
+
+        done = true;
+        if (consumer.joinable())
+            consumer.join();
+        delivery_pool::instance().cancel(task);
+
+        if (ns.size() < total)
+        {
+            fprintf(stderr, "wakeup: %s lost %u frames\n", names[m], total - unsigned(ns.size()));
+            exit(EXIT_FAILURE);
+        }
+        ns.erase(ns.begin(), ns.begin() + warmup());
+        report("wakeup", names[m], W, H, size, std::move(ns));
+    }
+}
+
+static void bench_debayer(int W, int H)
+{
+    const auto frame = random_frame(W, H);
+    std::vector<uint8_t> dest(frame.size() * 4);
+
+    static const struct { const char* name; debayer_fn debayer_impl::* fn; int bpp; } formats[] = {
+        { "gray", &debayer_impl::gray, 1 },
+        { "bgr", &debayer_impl::bgr, 3 },
+        { "rgb", &debayer_impl::rgb, 3 },
+        { "bgra", &debayer_impl::bgra, 4 },
+        { "rgba", &debayer_impl::rgba, 4 },
+        { "nv12", &debayer_impl::nv12, 1 },
+        { "i420", &debayer_impl::i420, 1 },
+        { "yuyv", &debayer_impl::yuyv, 2 },
+    };
+
+    char bench[64];
+    for (const auto& fmt : formats)
+    {
+        snprintf(bench, sizeof(bench), "debayer-%s", fmt.name);
+        for (const debayer_impl* impl : debayer_impls())
+            measure(bench, impl->name, W, H, frame.size(), [&] {
+                return time_ns([&] { (impl->*fmt.fn)(W, H, frame.data(), dest.data(), W * fmt.bpp, 1, H - 1); });
+            });
+    }
+
+    for (const debayer_impl* impl : debayer_impls())
+    {
+        measure("malvar-bgr", impl->name, W, H, frame.size(), [&] {
+            return time_ns([&] { impl->malvar.bgr(W, H, frame.data(), dest.data(), W * 3, 1, H - 1); });
+        });
+        measure("malvar-bgra", impl->name, W, H, frame.size(), [&] {
+            return time_ns([&] { impl->malvar.bgra(W, H, frame.data(), dest.data(), W * 4, 1, H - 1); });
+        });
+        measure("binned-gray", impl->name, W, H, frame.size(), [&] {
+            return time_ns([&] { impl->binned.gray(W, H, frame.data(), dest.data(), W / 2, 0, H / 2); });
+        });
+        measure("binned-bgr", impl->name, W, H, frame.size(), [&] {
+            return time_ns([&] { impl->binned.bgr(W, H, frame.data(), dest.data(), W / 2 * 3, 0, H / 2); });
+        });
+    }
+
+    // what get_frame() does, on all cores
+    auto queue = std::make_unique<frame_queue>();
+    queue->set_debayer_threads(std::max(1u, std::thread::hardware_concurrency()));
+    snprintf(bench, sizeof(bench), "threads-%u", queue->debayer_threads());
+    measure("convert-bgr", bench, W, H, frame.size(), [&] {
+        return time_ns([&] { queue->convert(frame.data(), dest.data(), W, H, frame_output{ format::BGR, W * 3 }); });
+    });
+    measure("convert-bgr-malvar", bench, W, H, frame.size(), [&] {
+        return time_ns([&] { queue->convert(frame.data(), dest.data(), W, H, frame_output{ format::BGR, W * 3, output_scale::full, ps3eye::demosaic::malvar }); });
+    });
+    measure("convert-bgr-half", bench, W, H, frame.size(), [&] {
+        return time_ns([&] { queue->convert(frame.data(), dest.data(), W, H, frame_output{ format::BGR, W / 2 * 3, output_scale::half }); });
+    });
+    measure("convert-nv12", bench, W, H, frame.size(), [&] {
+        return time_ns([&] { queue->convert(frame.data(), dest.data(), W, H, frame_output{ format::NV12, W }); });
+    });
+    // a tracker's window, a sixteenth of the frame
+    const ps3eye::frame_roi roi { W / 3 + 1, H / 3 + 1, W / 4, H / 4 };
+    measure("convert-bgr-roi", bench, W, H, frame.size(), [&] {
+        return time_ns([&] { queue->convert(frame.data(), dest.data(), W, H, frame_output{ format::BGR, W * 3, output_scale::full, ps3eye::demosaic::bilinear, &roi, 1 }); });
+    });
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+        iterations = (unsigned)std::max(1, atoi(argv[1]));
+
+    print_header();
+
+    static const int sizes[][2] = { { 320, 240 }, { 640, 480 } };
+
+    for (const auto& [ W, H ] : sizes)
+    {
+        bench_parse(W, H);
+        bench_queue(W, H);
+        bench_wakeup(W, H);
+        bench_debayer(W, H);
+    }
+
+    return EXIT_SUCCESS;
+}
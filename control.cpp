@@ -0,0 +1,78 @@
+#include "control.hpp"
+
+#include <utility>
+
+namespace ps3eye::detail {
+
+control_queue::~control_queue()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        exit_ = true;
+    }
+    wake_.notify_one();
+
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void control_queue::post(control c, int value, std::promise<int>* promise, done_fn done)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        slot& s = slots_[(unsigned)c];
+        s.value = value;
+        if (promise)
+            s.promises.push_back(std::move(*promise));
+        if (done)
+            s.callbacks.push_back(std::move(done));
+        if (!s.queued)
+        {
+            s.queued = true;
+            order_.push_back(c);
+        }
+
+        if (!thread_.joinable())
+            thread_ = std::thread(&control_queue::run, this);
+    }
+    wake_.notify_one();
+}
+
+void control_queue::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<std::promise<int>> promises;
+    std::vector<done_fn> callbacks;
+
+    for (;;)
+    {
+        wake_.wait(lock, [this] { return exit_ || !order_.empty(); });
+        if (order_.empty())
+            return;
+
+        control c = order_.front();
+        order_.erase(order_.begin());
+
+        slot& s = slots_[(unsigned)c];
+        const int value = s.value;
+        s.queued = false;
+        promises.swap(s.promises);
+        callbacks.swap(s.callbacks);
+
+        // Unlocked, so that callers queueing more don't wait for the bus.
+        lock.unlock();
+
+        const int error = apply_(data_, c, value);
+        for (std::promise<int>& p : promises)
+            p.set_value(error);
+        for (done_fn& fn : callbacks)
+            fn(error);
+        promises.clear();
+        callbacks.clear();
+
+        lock.lock();
+    }
+}
+
+} // ns ps3eye::detail
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "internal.hpp"
+
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ps3eye::detail {
+
+// Controls waiting for the bus, drained by a thread of its own. Setting a
+// control again before it went out replaces the value and keeps its place
+// in line, so only the last value is written.
+struct control_queue final
+{
+    // Writes the control and returns the camera's error code afterwards.
+    using apply_fn = int(*)(void* data, control c, int value);
+    using done_fn = std::function<void(int error)>;
+
+    control_queue(apply_fn fn, void* data) : apply_(fn), data_(data) {}
+    // Applies what's still queued first.
+    ~control_queue();
+
+    void post(control c, int value, std::promise<int>* promise, done_fn done);
+
+    control_queue(const control_queue&) = delete;
+    void operator=(const control_queue&) = delete;
+
+private:
+    static constexpr unsigned num_controls = (unsigned)control::test_pattern + 1;
+
+    struct slot
+    {
+        int value = 0;
+        bool queued = false;
+        std::vector<std::promise<int>> promises;
+        std::vector<done_fn> callbacks;
+    };
+
+    void run();
+
+    apply_fn apply_;
+    void* data_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::array<slot, num_controls> slots_;
+    std::vector<control> order_;
+    std::thread thread_;
+    bool exit_ = false;
+};
+
+} // ns ps3eye::detail
@@ -0,0 +1,210 @@
+#include "debayer.hpp"
+
+#ifdef __AVX2__
+
+#include "debayer-simd.hpp"
+#include <immintrin.h>
+
+namespace ps3eye::detail {
+namespace {
+
+struct avx2
+{
+    using u8 = __m256i;
+    static constexpr int N = 32;
+
+    static u8 load(const uint8_t* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void store(uint8_t* p, u8 a) { _mm256_storeu_si256((__m256i*)p, a); }
+
+    static u8 avg(u8 a, u8 b) { return _mm256_avg_epu8(a, b); }
+
+    // unpack and pack both work within 128-bit lanes, so lane order survives
+    static u8 avg4(u8 a, u8 b, u8 c, u8 d)
+    {
+        const __m256i zero = _mm256_setzero_si256(), two = _mm256_set1_epi16(2);
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero)),
+                                      _mm256_add_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(d, zero)));
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero)),
+                                      _mm256_add_epi16(_mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(d, zero)));
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2);
+        return _mm256_packus_epi16(lo, hi);
+    }
+
+    static u8 odd_lanes() { return _mm256_set1_epi16(0x00ff); }
+    static u8 select(u8 mask, u8 a, u8 b) { return _mm256_blendv_epi8(b, a, mask); }
+
+    static u8 gray(u8 r, u8 g, u8 b)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i kr = _mm256_set1_epi16(77), kg = _mm256_set1_epi16(151), kb = _mm256_set1_epi16(28);
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(r, zero), kr),
+                                                       _mm256_mullo_epi16(_mm256_unpacklo_epi8(g, zero), kg)),
+                                      _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), kb));
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(r, zero), kr),
+                                                       _mm256_mullo_epi16(_mm256_unpackhi_epi8(g, zero), kg)),
+                                      _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), kb));
+        return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8));
+    }
+
+    // pshufb masks interleaving 16 pixels of three planes into 48 bytes.
+    // Byte j of output block k holds channel (16k + j) % 3 of pixel
+    // (16k + j) / 3.
+    struct shuffle_masks
+    {
+        alignas(32) int8_t mask[3][3][32];
+
+        shuffle_masks()
+        {
+            for (int k = 0; k < 3; k++)
+                for (int ch = 0; ch < 3; ch++)
+                    for (int j = 0; j < 32; j++)
+                    {
+                        int pos = 16 * k + j % 16;
+                        mask[k][ch][j] = pos % 3 == ch ? (int8_t)(pos / 3) : (int8_t)-128;
+                    }
+        }
+    };
+
+    static void store3(uint8_t* p, u8 a, u8 b, u8 c)
+    {
+        static const shuffle_masks masks;
+        __m256i out[3];
+
+        for (int k = 0; k < 3; k++)
+        {
+            const __m256i* m = (const __m256i*)masks.mask[k];
+            out[k] = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(a, _mm256_load_si256(m + 0)),
+                                                     _mm256_shuffle_epi8(b, _mm256_load_si256(m + 1))),
+                                     _mm256_shuffle_epi8(c, _mm256_load_si256(m + 2)));
+        }
+
+        // lower lanes hold pixels 0-15, upper lanes pixels 16-31
+        for (int k = 0; k < 3; k++)
+            _mm_storeu_si128((__m128i*)p + k, _mm256_castsi256_si128(out[k]));
+        for (int k = 0; k < 3; k++)
+            _mm_storeu_si128((__m128i*)p + 3 + k, _mm256_extracti128_si256(out[k], 1));
+    }
+
+    static void store4(uint8_t* p, u8 a, u8 b, u8 c)
+    {
+        const __m256i alpha = _mm256_set1_epi8(-1);
+        __m256i ab_lo = _mm256_unpacklo_epi8(a, b), ab_hi = _mm256_unpackhi_epi8(a, b);
+        __m256i ca_lo = _mm256_unpacklo_epi8(c, alpha), ca_hi = _mm256_unpackhi_epi8(c, alpha);
+
+        // pixels 0-3 | 16-19, 4-7 | 20-23, 8-11 | 24-27, 12-15 | 28-31
+        __m256i px0 = _mm256_unpacklo_epi16(ab_lo, ca_lo), px1 = _mm256_unpackhi_epi16(ab_lo, ca_lo);
+        __m256i px2 = _mm256_unpacklo_epi16(ab_hi, ca_hi), px3 = _mm256_unpackhi_epi16(ab_hi, ca_hi);
+
+        _mm256_storeu_si256((__m256i*)p + 0, _mm256_permute2x128_si256(px0, px1, 0x20));
+        _mm256_storeu_si256((__m256i*)p + 1, _mm256_permute2x128_si256(px2, px3, 0x20));
+        _mm256_storeu_si256((__m256i*)p + 2, _mm256_permute2x128_si256(px0, px1, 0x31));
+        _mm256_storeu_si256((__m256i*)p + 3, _mm256_permute2x128_si256(px2, px3, 0x31));
+    }
+
+    static u8 luma(u8 r, u8 g, u8 b)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i kr = _mm256_set1_epi16(66), kg = _mm256_set1_epi16(129), kb = _mm256_set1_epi16(25);
+        const __m256i round = _mm256_set1_epi16(128), offset = _mm256_set1_epi16(16);
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(r, zero), kr),
+                                                       _mm256_mullo_epi16(_mm256_unpacklo_epi8(g, zero), kg)),
+                                      _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), kb), round));
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(r, zero), kr),
+                                                       _mm256_mullo_epi16(_mm256_unpackhi_epi8(g, zero), kg)),
+                                      _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), kb), round));
+        lo = _mm256_add_epi16(_mm256_srli_epi16(lo, 8), offset);
+        hi = _mm256_add_epi16(_mm256_srli_epi16(hi, 8), offset);
+        return _mm256_packus_epi16(lo, hi);
+    }
+
+    template<int kr, int kg, int kb>
+    static u8 chroma(u8 r, u8 g, u8 b)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i round = _mm256_set1_epi16(128);
+        const __m256i mr = _mm256_set1_epi16(kr), mg = _mm256_set1_epi16(kg), mb = _mm256_set1_epi16(kb);
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(r, zero), mr),
+                                                       _mm256_mullo_epi16(_mm256_unpacklo_epi8(g, zero), mg)),
+                                      _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), mb), round));
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(r, zero), mr),
+                                                       _mm256_mullo_epi16(_mm256_unpackhi_epi8(g, zero), mg)),
+                                      _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), mb), round));
+        lo = _mm256_add_epi16(_mm256_srai_epi16(lo, 8), round);
+        hi = _mm256_add_epi16(_mm256_srai_epi16(hi, 8), round);
+        return _mm256_packus_epi16(lo, hi);
+    }
+
+    static __m256i pair_sums(u8 a)
+    {
+        const __m256i even = _mm256_set1_epi16(0x00ff);
+        return _mm256_add_epi16(_mm256_and_si256(a, even), _mm256_srli_epi16(a, 8));
+    }
+
+    // packus interleaves the 128-bit lanes of its operands, put them back
+    static u8 quad_avg(u8 a0, u8 a1, u8 b0, u8 b1)
+    {
+        const __m256i two = _mm256_set1_epi16(2);
+        __m256i lo = _mm256_add_epi16(_mm256_add_epi16(pair_sums(a0), pair_sums(b0)), two);
+        __m256i hi = _mm256_add_epi16(_mm256_add_epi16(pair_sums(a1), pair_sums(b1)), two);
+        __m256i x = _mm256_packus_epi16(_mm256_srli_epi16(lo, 2), _mm256_srli_epi16(hi, 2));
+        return _mm256_permute4x64_epi64(x, 0xd8);
+    }
+
+    static void zip(u8 a, u8 b, u8& lo, u8& hi)
+    {
+        __m256i l = _mm256_unpacklo_epi8(a, b), h = _mm256_unpackhi_epi8(a, b);
+        lo = _mm256_permute2x128_si256(l, h, 0x20);
+        hi = _mm256_permute2x128_si256(l, h, 0x31);
+    }
+
+    static void unzip(u8 a0, u8 a1, u8& even, u8& odd)
+    {
+        const __m256i mask = _mm256_set1_epi16(0x00ff);
+        even = _mm256_packus_epi16(_mm256_and_si256(a0, mask), _mm256_and_si256(a1, mask));
+        odd = _mm256_packus_epi16(_mm256_srli_epi16(a0, 8), _mm256_srli_epi16(a1, 8));
+        even = _mm256_permute4x64_epi64(even, 0xd8);
+        odd = _mm256_permute4x64_epi64(odd, 0xd8);
+    }
+
+    using i16 = __m256i;
+
+    static i16 widen_even(u8 a) { return _mm256_and_si256(a, _mm256_set1_epi16(0x00ff)); }
+    static i16 widen_odd(u8 a) { return _mm256_srli_epi16(a, 8); }
+    static i16 add16(i16 a, i16 b) { return _mm256_add_epi16(a, b); }
+    static i16 sub16(i16 a, i16 b) { return _mm256_sub_epi16(a, b); }
+    template<int n> static i16 shl16(i16 a) { return _mm256_slli_epi16(a, n); }
+
+    static i16 fixed_q4(i16 a)
+    {
+        a = _mm256_srai_epi16(_mm256_add_epi16(a, _mm256_set1_epi16(8)), 4);
+        return _mm256_min_epi16(_mm256_max_epi16(a, _mm256_setzero_si256()), _mm256_set1_epi16(255));
+    }
+
+    static u8 merge(i16 even, i16 odd) { return _mm256_or_si256(even, _mm256_slli_epi16(odd, 8)); }
+};
+
+} // anonymous ns
+
+const debayer_impl* debayer_avx2()
+{
+    static const debayer_impl impl = {
+        "avx2", debayer_gray_simd<avx2>, debayer_rgb_simd<avx2, true>, debayer_rgb_simd<avx2, false>,
+        debayer_rgb_simd<avx2, true, 4>, debayer_rgb_simd<avx2, false, 4>,
+        debayer_yuv_simd<avx2, yuv_layout::nv12>, debayer_yuv_simd<avx2, yuv_layout::i420>,
+        debayer_yuv_simd<avx2, yuv_layout::yuyv>,
+        { debayer_binned_simd<avx2, 1>, debayer_binned_simd<avx2, 3, true>, debayer_binned_simd<avx2, 3, false>,
+          debayer_binned_simd<avx2, 4, true>, debayer_binned_simd<avx2, 4, false> },
+        { debayer_malvar_simd<avx2, true>, debayer_malvar_simd<avx2, false>,
+          debayer_malvar_simd<avx2, true, 4>, debayer_malvar_simd<avx2, false, 4> },
+    };
+    return &impl;
+}
+
+} // ns ps3eye::detail
+
+#else
+
+const ps3eye::detail::debayer_impl* ps3eye::detail::debayer_avx2() { return nullptr; }
+
+#endif
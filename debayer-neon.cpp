@@ -0,0 +1,150 @@
+#include "debayer.hpp"
+
+#if defined __ARM_NEON || defined __ARM_NEON__ || defined _M_ARM64
+
+#include "debayer-simd.hpp"
+#include <arm_neon.h>
+
+namespace ps3eye::detail {
+namespace {
+
+struct neon
+{
+    using u8 = uint8x16_t;
+    static constexpr int N = 16;
+
+    static u8 load(const uint8_t* p) { return vld1q_u8(p); }
+    static void store(uint8_t* p, u8 a) { vst1q_u8(p, a); }
+
+    static u8 avg(u8 a, u8 b) { return vrhaddq_u8(a, b); }
+
+    static u8 avg4(u8 a, u8 b, u8 c, u8 d)
+    {
+        uint16x8_t lo = vaddq_u16(vaddl_u8(vget_low_u8(a), vget_low_u8(b)),
+                                  vaddl_u8(vget_low_u8(c), vget_low_u8(d)));
+        uint16x8_t hi = vaddq_u16(vaddl_u8(vget_high_u8(a), vget_high_u8(b)),
+                                  vaddl_u8(vget_high_u8(c), vget_high_u8(d)));
+        // rounding shift: (x + 2) >> 2
+        return vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2));
+    }
+
+    static u8 odd_lanes() { return vreinterpretq_u8_u16(vdupq_n_u16(0x00ff)); }
+    static u8 select(u8 mask, u8 a, u8 b) { return vbslq_u8(mask, a, b); }
+
+    static u8 gray(u8 r, u8 g, u8 b)
+    {
+        const uint8x8_t kr = vdup_n_u8(77), kg = vdup_n_u8(151), kb = vdup_n_u8(28);
+        uint16x8_t lo = vmull_u8(vget_low_u8(r), kr);
+        lo = vmlal_u8(lo, vget_low_u8(g), kg);
+        lo = vmlal_u8(lo, vget_low_u8(b), kb);
+        uint16x8_t hi = vmull_u8(vget_high_u8(r), kr);
+        hi = vmlal_u8(hi, vget_high_u8(g), kg);
+        hi = vmlal_u8(hi, vget_high_u8(b), kb);
+        return vcombine_u8(vshrn_n_u16(lo, 8), vshrn_n_u16(hi, 8));
+    }
+
+    static void store3(uint8_t* p, u8 a, u8 b, u8 c)
+    {
+        uint8x16x3_t px = {{ a, b, c }};
+        vst3q_u8(p, px);
+    }
+
+    static void store4(uint8_t* p, u8 a, u8 b, u8 c)
+    {
+        uint8x16x4_t px = {{ a, b, c, vdupq_n_u8(0xff) }};
+        vst4q_u8(p, px);
+    }
+
+    static u8 luma(u8 r, u8 g, u8 b)
+    {
+        const uint8x8_t kr = vdup_n_u8(66), kg = vdup_n_u8(129), kb = vdup_n_u8(25);
+        const uint16x8_t offset = vdupq_n_u16(16);
+        uint16x8_t lo = vmull_u8(vget_low_u8(r), kr);
+        lo = vmlal_u8(lo, vget_low_u8(g), kg);
+        lo = vmlal_u8(lo, vget_low_u8(b), kb);
+        uint16x8_t hi = vmull_u8(vget_high_u8(r), kr);
+        hi = vmlal_u8(hi, vget_high_u8(g), kg);
+        hi = vmlal_u8(hi, vget_high_u8(b), kb);
+        // rounding shift: (x + 128) >> 8
+        return vcombine_u8(vmovn_u16(vaddq_u16(vrshrq_n_u16(lo, 8), offset)),
+                           vmovn_u16(vaddq_u16(vrshrq_n_u16(hi, 8), offset)));
+    }
+
+    static int16x8_t chroma_half(uint8x8_t r, uint8x8_t g, uint8x8_t b, int kr, int kg, int kb)
+    {
+        int16x8_t x = vmulq_n_s16(vreinterpretq_s16_u16(vmovl_u8(r)), (int16_t)kr);
+        x = vmlaq_n_s16(x, vreinterpretq_s16_u16(vmovl_u8(g)), (int16_t)kg);
+        x = vmlaq_n_s16(x, vreinterpretq_s16_u16(vmovl_u8(b)), (int16_t)kb);
+        // rounding shift: (x + 128) >> 8
+        return vaddq_s16(vrshrq_n_s16(x, 8), vdupq_n_s16(128));
+    }
+
+    template<int kr, int kg, int kb>
+    static u8 chroma(u8 r, u8 g, u8 b)
+    {
+        return vcombine_u8(vqmovun_s16(chroma_half(vget_low_u8(r), vget_low_u8(g), vget_low_u8(b), kr, kg, kb)),
+                           vqmovun_s16(chroma_half(vget_high_u8(r), vget_high_u8(g), vget_high_u8(b), kr, kg, kb)));
+    }
+
+    static u8 quad_avg(u8 a0, u8 a1, u8 b0, u8 b1)
+    {
+        uint16x8_t lo = vaddq_u16(vpaddlq_u8(a0), vpaddlq_u8(b0));
+        uint16x8_t hi = vaddq_u16(vpaddlq_u8(a1), vpaddlq_u8(b1));
+        return vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2));
+    }
+
+    static void zip(u8 a, u8 b, u8& lo, u8& hi)
+    {
+        uint8x16x2_t x = vzipq_u8(a, b);
+        lo = x.val[0];
+        hi = x.val[1];
+    }
+
+    static void unzip(u8 a0, u8 a1, u8& even, u8& odd)
+    {
+        uint8x16x2_t x = vuzpq_u8(a0, a1);
+        even = x.val[0];
+        odd = x.val[1];
+    }
+
+    using i16 = int16x8_t;
+
+    static i16 widen_even(u8 a) { return vreinterpretq_s16_u16(vandq_u16(vreinterpretq_u16_u8(a), vdupq_n_u16(0x00ff))); }
+    static i16 widen_odd(u8 a) { return vreinterpretq_s16_u16(vshrq_n_u16(vreinterpretq_u16_u8(a), 8)); }
+    static i16 add16(i16 a, i16 b) { return vaddq_s16(a, b); }
+    static i16 sub16(i16 a, i16 b) { return vsubq_s16(a, b); }
+    template<int n> static i16 shl16(i16 a) { return vshlq_n_s16(a, n); }
+
+    // saturating rounding shift: (a + 8) >> 4, then back to 16 bits
+    static i16 fixed_q4(i16 a) { return vreinterpretq_s16_u16(vmovl_u8(vqrshrun_n_s16(a, 4))); }
+
+    static u8 merge(i16 even, i16 odd)
+    {
+        return vreinterpretq_u8_s16(vorrq_s16(even, vshlq_n_s16(odd, 8)));
+    }
+};
+
+} // anonymous ns
+
+const debayer_impl* debayer_neon()
+{
+    static const debayer_impl impl = {
+        "neon", debayer_gray_simd<neon>, debayer_rgb_simd<neon, true>, debayer_rgb_simd<neon, false>,
+        debayer_rgb_simd<neon, true, 4>, debayer_rgb_simd<neon, false, 4>,
+        debayer_yuv_simd<neon, yuv_layout::nv12>, debayer_yuv_simd<neon, yuv_layout::i420>,
+        debayer_yuv_simd<neon, yuv_layout::yuyv>,
+        { debayer_binned_simd<neon, 1>, debayer_binned_simd<neon, 3, true>, debayer_binned_simd<neon, 3, false>,
+          debayer_binned_simd<neon, 4, true>, debayer_binned_simd<neon, 4, false> },
+        { debayer_malvar_simd<neon, true>, debayer_malvar_simd<neon, false>,
+          debayer_malvar_simd<neon, true, 4>, debayer_malvar_simd<neon, false, 4> },
+    };
+    return &impl;
+}
+
+} // ns ps3eye::detail
+
+#else
+
+const ps3eye::detail::debayer_impl* ps3eye::detail::debayer_neon() { return nullptr; }
+
+#endif
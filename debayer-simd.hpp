@@ -0,0 +1,607 @@
+#pragma once
+
+// Vectorized GRBG debayering, shared by the per-instruction-set translation
+// units. Each of them defines a traits type `V` and instantiates the kernels
+// below. Everything here has internal linkage on purpose: these units are
+// built with their own -m flags, and no inline function built with them may
+// be merged with its baseline counterpart by the linker.
+//
+// The kernels compute exactly the same integer expressions as the scalar
+// reference in debayer.cpp, they only do it for V::N pixels at a time:
+//
+// G R G R G R      row y even: G at x even, R at x odd
+// B G B G B G      row y odd:  B at x even, G at x odd
+//
+// For every pixel we compute the average of the horizontal neighbors, of
+// the vertical neighbors, of the four direct neighbors and of the four
+// diagonal neighbors, then pick per lane depending on the Bayer phase.
+//
+// V must provide:
+//
+// - `N`, the number of 8-bit lanes,
+// - `load(p)` and `store(p, a)`, both unaligned,
+// - `avg(a, b)` for (a + b + 1) >> 1,
+// - `avg4(a, b, c, d)` for (a + b + c + d + 2) >> 2,
+// - `odd_lanes()`, all ones in lanes 0, 2, 4, ...; lane 0 is always at an
+//   odd x, hence the name,
+// - `select(mask, a, b)`, a where mask is set and b elsewhere,
+// - `gray(r, g, b)` for (r * 77 + g * 151 + b * 28) >> 8,
+// - `store3(p, a, b, c)` storing a, b, c interleaved,
+// - `store4(p, a, b, c)` storing a, b, c, 0xff interleaved,
+// - `luma(r, g, b)` for ((66r + 129g + 25b + 128) >> 8) + 16,
+// - `chroma<kr, kg, kb>(r, g, b)` for ((kr*r + kg*g + kb*b + 128) >> 8) + 128
+//   in signed arithmetic, for the U and V coefficients,
+// - `quad_avg(a0, a1, b0, b1)`, the rounded averages of the 2x2 blocks of
+//   two rows of 2N pixels, a0 a1 above b0 b1,
+// - `zip(a, b, lo, hi)` interleaving a and b into 2N lanes,
+// - `unzip(a0, a1, even, odd)`, the reverse, splitting 2N lanes,
+// - an `i16` type of N/2 signed 16-bit lanes, with `widen_even(a)` and
+//   `widen_odd(a)` zero-extending lanes 0, 2, 4, ... or 1, 3, 5, ... of
+//   a, `add16`, `sub16`, `shl16<n>`, `fixed_q4(a)` for (a + 8) >> 4
+//   clamped to 0-255, and `merge(even, odd)` putting lanes of 0-255 back
+//   in the place they were widened from.
+
+#include "debayer.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ps3eye::detail {
+namespace {
+
+struct rgb_px { unsigned r, g, b; };
+
+inline rgb_px interpolate(const uint8_t* __restrict above, const uint8_t* __restrict row,
+                          const uint8_t* __restrict below, int x, bool bg_row)
+{
+    unsigned center = row[x];
+    unsigned horiz = (row[x-1] + row[x+1] + 1) >> 1;
+    unsigned vert = (above[x] + below[x] + 1) >> 1;
+
+    if (bg_row == !(x & 1))
+    {
+        unsigned cross = (above[x] + row[x-1] + row[x+1] + below[x] + 2) >> 2;
+        unsigned diag = (above[x-1] + above[x+1] + below[x-1] + below[x+1] + 2) >> 2;
+
+        if (bg_row)
+            return { diag, cross, center };
+        else
+            return { center, cross, diag };
+    }
+    else if (bg_row)
+        return { vert, center, horiz };
+    else
+        return { horiz, center, vert };
+}
+
+template<typename V>
+struct bayer_planes
+{
+    typename V::u8 r, g, b;
+};
+
+template<typename V>
+inline bayer_planes<V> interpolate(const uint8_t* above, const uint8_t* row,
+                                   const uint8_t* below, int x, bool bg_row)
+{
+    using u8 = typename V::u8;
+
+    u8 up = V::load(above + x), down = V::load(below + x);
+    u8 left = V::load(row + x - 1), right = V::load(row + x + 1);
+    u8 center = V::load(row + x);
+
+    u8 horiz = V::avg(left, right);
+    u8 vert = V::avg(up, down);
+    u8 cross = V::avg4(up, left, right, down);
+    u8 diag = V::avg4(V::load(above + x - 1), V::load(above + x + 1),
+                      V::load(below + x - 1), V::load(below + x + 1));
+
+    u8 odd = V::odd_lanes();
+
+    if (bg_row)
+        return { V::select(odd, vert, diag), V::select(odd, center, cross), V::select(odd, horiz, center) };
+    else
+        return { V::select(odd, center, horiz), V::select(odd, cross, center), V::select(odd, diag, vert) };
+}
+
+// Calls fn(x) for vector columns and px(x) for leftover columns so that
+// all of [1, W-2] is covered. The last vector overlaps the previous one
+// rather than leaving a scalar tail; x stays odd for every vector.
+template<typename V, typename F, typename P>
+inline void for_each_column(int W, F&& fn, P&& px)
+{
+    if (W - 2 < V::N)
+    {
+        for (int x = 1; x < W - 1; x++)
+            px(x);
+        return;
+    }
+
+    int x = 1;
+    for (; x + V::N <= W - 1; x += V::N)
+        fn(x);
+    if (x < W - 1)
+        fn(W - 1 - V::N);
+}
+
+// Copy the second and second-to-last rows over the first and last ones,
+// like the scalar code does, if the band [y0, y1) is next to them.
+inline void fill_edge_rows(int H, int stride, int row_bytes, uint8_t* buf, int y0, int y1)
+{
+    if (y0 == 1)
+        memcpy(buf, buf + stride, (unsigned)row_bytes);
+    if (y1 == H - 1)
+        memcpy(buf + (H - 1) * stride, buf + (H - 2) * stride, (unsigned)row_bytes);
+}
+
+template<typename V>
+void debayer_gray_simd(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                       int stride, int y0, int y1)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        const uint8_t* row = input + y * W;
+        const uint8_t* above = row - W;
+        const uint8_t* below = row + W;
+        uint8_t* dest = buf + y * stride;
+        bool bg_row = y & 1;
+
+        for_each_column<V>(W, [&](int x) {
+            bayer_planes<V> p = interpolate<V>(above, row, below, x, bg_row);
+            V::store(dest + x, V::gray(p.r, p.g, p.b));
+        }, [&](int x) {
+            rgb_px p = interpolate(above, row, below, x, bg_row);
+            dest[x] = (uint8_t)((p.r * 77 + p.g * 151 + p.b * 28) >> 8);
+        });
+
+        dest[0] = dest[1];
+        dest[W - 1] = dest[W - 2];
+    }
+
+    fill_edge_rows(H, stride, W, buf, y0, y1);
+}
+
+template<typename V, bool in_BGR, int num_output_channels = 3>
+void debayer_rgb_simd(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                      int stride, int y0, int y1)
+{
+    const int dest_stride = stride;
+
+    for (int y = y0; y < y1; y++)
+    {
+        const uint8_t* row = input + y * W;
+        const uint8_t* above = row - W;
+        const uint8_t* below = row + W;
+        uint8_t* dest = buf + y * dest_stride;
+        bool bg_row = y & 1;
+
+        for_each_column<V>(W, [&](int x) {
+            bayer_planes<V> p = interpolate<V>(above, row, below, x, bg_row);
+            typename V::u8 first = in_BGR ? p.b : p.r, third = in_BGR ? p.r : p.b;
+            if (num_output_channels == 4)
+                V::store4(dest + x * num_output_channels, first, p.g, third);
+            else
+                V::store3(dest + x * num_output_channels, first, p.g, third);
+        }, [&](int x) {
+            rgb_px p = interpolate(above, row, below, x, bg_row);
+            uint8_t* px = dest + x * num_output_channels;
+            px[0] = (uint8_t)(in_BGR ? p.b : p.r);
+            px[1] = (uint8_t)p.g;
+            px[2] = (uint8_t)(in_BGR ? p.r : p.b);
+            if (num_output_channels == 4)
+                px[3] = 0xff;
+        });
+
+        memcpy(dest, dest + num_output_channels, num_output_channels);
+        memcpy(dest + (W - 1) * num_output_channels, dest + (W - 2) * num_output_channels, num_output_channels);
+    }
+
+    fill_edge_rows(H, dest_stride, W * num_output_channels, buf, y0, y1);
+}
+
+// Interpolate row y, or the row it's a copy of, into planes of W bytes.
+template<typename V>
+void interpolate_planes(int W, int H, const uint8_t* __restrict input, int y,
+                        uint8_t* __restrict r, uint8_t* __restrict g, uint8_t* __restrict b)
+{
+    y = std::clamp(y, 1, H - 2);
+    const uint8_t* row = input + y * W;
+    const uint8_t* above = row - W;
+    const uint8_t* below = row + W;
+    bool bg_row = y & 1;
+
+    for_each_column<V>(W, [&](int x) {
+        bayer_planes<V> p = interpolate<V>(above, row, below, x, bg_row);
+        V::store(r + x, p.r);
+        V::store(g + x, p.g);
+        V::store(b + x, p.b);
+    }, [&](int x) {
+        rgb_px p = interpolate(above, row, below, x, bg_row);
+        r[x] = (uint8_t)p.r;
+        g[x] = (uint8_t)p.g;
+        b[x] = (uint8_t)p.b;
+    });
+
+    for (uint8_t* plane : { r, g, b })
+    {
+        plane[0] = plane[1];
+        plane[W - 1] = plane[W - 2];
+    }
+}
+
+inline uint8_t yuv_y(unsigned r, unsigned g, unsigned b)
+{
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+inline uint8_t yuv_u(int r, int g, int b)
+{
+    return (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+inline uint8_t yuv_v(int r, int g, int b)
+{
+    return (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+// Calls fn(x) for x = 0, step, 2*step ... covering [0, n). As in
+// for_each_column, the last one overlaps rather than leaving a tail;
+// false if n < step.
+template<typename F>
+inline bool for_each_block(int n, int step, F&& fn)
+{
+    if (n < step)
+        return false;
+    int x = 0;
+    for (; x + step <= n; x += step)
+        fn(x);
+    if (x < n)
+        fn(n - step);
+    return true;
+}
+
+// The RGB of one row (YUYV) or two (4:2:0) gets interpolated into planes
+// that stay in L1, then turned into Y and subsampled U/V from there.
+template<typename V, yuv_layout layout>
+void debayer_yuv_simd(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                      int stride, int y0, int y1)
+{
+    using u8 = typename V::u8;
+    constexpr bool subsampled = layout != yuv_layout::yuyv;
+    constexpr int rows = subsampled ? 2 : 1;
+    const int first = y0 == 1 ? 0 : y0, last = y1 == H - 1 ? H : y1;
+    const int chroma_width = W / 2;
+
+    std::vector<uint8_t> planes(unsigned(W * 3 * rows));
+    uint8_t* r[2] = { &planes[0], &planes[unsigned(W * 3 * (rows - 1))] };
+    uint8_t* g[2] = { r[0] + W, r[1] + W };
+    uint8_t* b[2] = { r[0] + 2 * W, r[1] + 2 * W };
+
+    for (int y = first; y < last; y += rows)
+    {
+        for (int k = 0; k < rows; k++)
+            interpolate_planes<V>(W, H, input, y + k, r[k], g[k], b[k]);
+
+        // c is a chroma sample, covering pixels 2c and 2c + 1
+        auto chroma_px = [&](int c, int& R, int& G, int& B) {
+            int x = c * 2;
+            R = (r[0][x] + r[0][x+1] + r[1][x] + r[1][x+1] + 2) >> 2;
+            G = (g[0][x] + g[0][x+1] + g[1][x] + g[1][x+1] + 2) >> 2;
+            B = (b[0][x] + b[0][x+1] + b[1][x] + b[1][x+1] + 2) >> 2;
+        };
+        auto chroma = [&](int c, u8& U, u8& V_) {
+            int x = c * 2;
+            u8 R = V::quad_avg(V::load(r[0] + x), V::load(r[0] + x + V::N), V::load(r[1] + x), V::load(r[1] + x + V::N));
+            u8 G = V::quad_avg(V::load(g[0] + x), V::load(g[0] + x + V::N), V::load(g[1] + x), V::load(g[1] + x + V::N));
+            u8 B = V::quad_avg(V::load(b[0] + x), V::load(b[0] + x + V::N), V::load(b[1] + x), V::load(b[1] + x + V::N));
+            U = V::template chroma<-38, -74, 112>(R, G, B);
+            V_ = V::template chroma<112, -94, -18>(R, G, B);
+        };
+
+        if (layout == yuv_layout::yuyv)
+        {
+            // averaging a row with itself gives (a + b + 1) >> 1
+            uint8_t* dest = buf + y * stride;
+
+            if (!for_each_block(chroma_width, V::N, [&](int c) {
+                u8 U, V_, uv[2], out[4];
+                chroma(c, U, V_);
+                V::zip(U, V_, uv[0], uv[1]);
+                for (int k = 0; k < 2; k++)
+                {
+                    int x = c * 2 + k * V::N;
+                    V::zip(V::luma(V::load(r[0] + x), V::load(g[0] + x), V::load(b[0] + x)), uv[k], out[2*k], out[2*k+1]);
+                }
+                for (int k = 0; k < 4; k++)
+                    V::store(dest + c * 4 + k * V::N, out[k]);
+            }))
+            {
+                for (int c = 0; c < chroma_width; c++)
+                {
+                    int R, G, B, x = c * 2;
+                    chroma_px(c, R, G, B);
+                    dest[c * 4 + 0] = yuv_y(r[0][x], g[0][x], b[0][x]);
+                    dest[c * 4 + 1] = yuv_u(R, G, B);
+                    dest[c * 4 + 2] = yuv_y(r[0][x+1], g[0][x+1], b[0][x+1]);
+                    dest[c * 4 + 3] = yuv_v(R, G, B);
+                }
+            }
+            continue;
+        }
+
+        for (int k = 0; k < rows; k++)
+        {
+            uint8_t* dest = buf + (y + k) * stride;
+            if (!for_each_block(W, V::N, [&](int x) {
+                V::store(dest + x, V::luma(V::load(r[k] + x), V::load(g[k] + x), V::load(b[k] + x)));
+            }))
+            {
+                for (int x = 0; x < W; x++)
+                    dest[x] = yuv_y(r[k][x], g[k][x], b[k][x]);
+            }
+        }
+
+        uint8_t* u_row = buf + stride * H + y / 2 * (stride / 2);
+        uint8_t* v_row = u_row + (stride / 2) * (H / 2);
+        uint8_t* uv_row = buf + stride * H + y / 2 * stride;
+
+        if (!for_each_block(chroma_width, V::N, [&](int c) {
+            u8 U, V_;
+            chroma(c, U, V_);
+            if (layout == yuv_layout::nv12)
+            {
+                u8 lo, hi;
+                V::zip(U, V_, lo, hi);
+                V::store(uv_row + c * 2, lo);
+                V::store(uv_row + c * 2 + V::N, hi);
+            }
+            else
+            {
+                V::store(u_row + c, U);
+                V::store(v_row + c, V_);
+            }
+        }))
+        {
+            for (int c = 0; c < chroma_width; c++)
+            {
+                int R, G, B;
+                chroma_px(c, R, G, B);
+                if (layout == yuv_layout::nv12)
+                {
+                    uv_row[c * 2] = yuv_u(R, G, B);
+                    uv_row[c * 2 + 1] = yuv_v(R, G, B);
+                }
+                else
+                {
+                    u_row[c] = yuv_u(R, G, B);
+                    v_row[c] = yuv_v(R, G, B);
+                }
+            }
+        }
+    }
+}
+
+// One pixel per 2x2 quad, see debayer_impl::binned. One channel is gray.
+template<typename V, int num_output_channels, bool in_BGR = true>
+void debayer_binned_simd(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                         int stride, int y0, int y1)
+{
+    using u8 = typename V::u8;
+    (void)H;
+
+    for (int y = y0; y < y1; y++)
+    {
+        // G R
+        // B G
+        const uint8_t* top = input + 2 * y * W;
+        const uint8_t* bottom = top + W;
+        uint8_t* dest = buf + y * stride;
+
+        auto store = [&](uint8_t* p, auto r, auto g, auto b) {
+            if constexpr (num_output_channels == 1)
+                V::store(p, V::gray(r, g, b));
+            else if constexpr (num_output_channels == 3)
+                V::store3(p, in_BGR ? b : r, g, in_BGR ? r : b);
+            else
+                V::store4(p, in_BGR ? b : r, g, in_BGR ? r : b);
+        };
+
+        if (!for_each_block(W / 2, V::N, [&](int x) {
+            u8 g0, r, b, g1;
+            V::unzip(V::load(top + 2 * x), V::load(top + 2 * x + V::N), g0, r);
+            V::unzip(V::load(bottom + 2 * x), V::load(bottom + 2 * x + V::N), b, g1);
+            store(dest + x * num_output_channels, r, V::avg(g0, g1), b);
+        }))
+        {
+            for (int x = 0; x < W / 2; x++)
+            {
+                unsigned R = top[2 * x + 1], B = bottom[2 * x];
+                unsigned G = (top[2 * x] + bottom[2 * x + 1] + 1) >> 1;
+                uint8_t* px = dest + x * num_output_channels;
+
+                if (num_output_channels == 1)
+                    px[0] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+                else
+                {
+                    px[0] = (uint8_t)(in_BGR ? B : R);
+                    px[1] = (uint8_t)G;
+                    px[2] = (uint8_t)(in_BGR ? R : B);
+                    if (num_output_channels == 4)
+                        px[3] = 0xff;
+                }
+            }
+        }
+    }
+}
+
+// As for_each_column, for kernels reading two pixels either side: vectors
+// cover [3, W-3] as far as they can, px(x) the rest of [1, W-2].
+template<typename V, typename F, typename P>
+inline void for_each_wide_column(int W, F&& fn, P&& px)
+{
+    // the last odd x whose vector stays clear of the row's end
+    int last = W - 2 - V::N;
+    if (last % 2 == 0)
+        last--;
+
+    if (last < 3)
+    {
+        for (int x = 1; x < W - 1; x++)
+            px(x);
+        return;
+    }
+
+    px(1);
+    px(2);
+    int x = 3;
+    for (; x <= last; x += V::N)
+        fn(x);
+    if (x < last + V::N)
+        fn(last), x = last + V::N;
+    for (; x < W - 1; x++)
+        px(x);
+}
+
+// Malvar-He-Cutler at one pixel, see debayer_impl::malvar. rows[] are
+// rows y-2 to y+2, mirrored at the frame's edges like the columns.
+inline rgb_px malvar(const uint8_t* const* rows, int W, int x, bool bg_row)
+{
+    auto p = [&](int dx, int dy) {
+        int i = x + dx;
+        return (int)rows[dy + 2][i < 0 ? -i : i >= W ? 2 * (W - 1) - i : i];
+    };
+    auto fixed = [](int sum) { return (unsigned)std::clamp((sum + 8) >> 4, 0, 255); };
+
+    int center = p(0, 0);
+    int h1 = p(-1, 0) + p(1, 0), v1 = p(0, -1) + p(0, 1);
+    int h2 = p(-2, 0) + p(2, 0), v2 = p(0, -2) + p(0, 2);
+    int diag = p(-1, -1) + p(1, -1) + p(-1, 1) + p(1, 1);
+
+    unsigned cross = fixed(8 * center + 4 * (h1 + v1) - 2 * (h2 + v2));
+    unsigned horiz = fixed(10 * center + 8 * h1 - 2 * h2 - 2 * diag + v2);
+    unsigned vert = fixed(10 * center + 8 * v1 - 2 * v2 - 2 * diag + h2);
+    unsigned opposite = fixed(12 * center + 4 * diag - 3 * (h2 + v2));
+
+    if (bg_row == !(x & 1))
+        return bg_row ? rgb_px{ opposite, cross, (unsigned)center } : rgb_px{ (unsigned)center, cross, opposite };
+    else if (bg_row)
+        return { vert, (unsigned)center, horiz };
+    else
+        return { horiz, (unsigned)center, vert };
+}
+
+// The filters below keep two dozen vectors live; unless they're inlined
+// into the column loop these go through memory.
+#if defined _MSC_VER && !defined __clang__
+#   define DEBAYER_INLINE __forceinline
+#else
+#   define DEBAYER_INLINE inline __attribute__((always_inline))
+#endif
+
+template<typename V>
+struct malvar_taps
+{
+    typename V::i16 c, h1, v1, h2, v2, diag;
+};
+
+// The 5x5 neighborhood sums of the pixels at odd x, lanes 0, 2, 4, ...,
+// or at even x. Pixels dx to the right of those are taken from vectors
+// loaded at x-2, x and x+2 only, so both parities share the loads.
+template<typename V, bool even_x>
+DEBAYER_INLINE malvar_taps<V> gather_taps(const uint8_t* const* rows, int x)
+{
+    auto px = [x](const uint8_t* row, int dx) {
+        dx += even_x;
+        return dx & 1 ? V::widen_odd(V::load(row + x + dx - 1)) : V::widen_even(V::load(row + x + dx));
+    };
+    malvar_taps<V> t;
+
+    t.c = px(rows[2], 0);
+    t.h1 = V::add16(px(rows[2], -1), px(rows[2], 1));
+    t.v1 = V::add16(px(rows[1], 0), px(rows[3], 0));
+    t.h2 = V::add16(px(rows[2], -2), px(rows[2], 2));
+    t.v2 = V::add16(px(rows[0], 0), px(rows[4], 0));
+    t.diag = V::add16(V::add16(px(rows[1], -1), px(rows[1], 1)), V::add16(px(rows[3], -1), px(rows[3], 1)));
+    return t;
+}
+
+// The pixels at odd and at even x want different filters, so lanes are
+// split by parity into 16-bit lanes and each half gets only the two it
+// needs. The sums stay within +-7200, 16 bits are plenty.
+template<typename V, bool bg_row>
+DEBAYER_INLINE bayer_planes<V> malvar(const uint8_t* const* rows, int x)
+{
+    using i16 = typename V::i16;
+
+    // R on G R rows, B on B G rows, and G
+    const malvar_taps<V> rb = gather_taps<V, bg_row>(rows, x), g = gather_taps<V, !bg_row>(rows, x);
+
+    // at R and B: 8c + 4(h1 + v1) - 2(h2 + v2) for G,
+    // 12c + 4 diag - 3(h2 + v2) for the other one
+    i16 far = V::add16(rb.h2, rb.v2);
+    i16 cross = V::template shl16<1>(V::sub16(V::template shl16<1>(V::add16(V::template shl16<1>(rb.c),
+                                                                            V::add16(rb.h1, rb.v1))), far));
+    i16 opposite = V::sub16(V::template shl16<2>(V::add16(V::add16(V::template shl16<1>(rb.c), rb.c), rb.diag)),
+                            V::add16(far, V::template shl16<1>(far)));
+
+    // at G: 10c - 2 diag, plus 8 h1 - 2 h2 + v2 or the transpose
+    i16 base = V::template shl16<1>(V::sub16(V::add16(V::template shl16<2>(g.c), g.c), g.diag));
+    i16 horiz = V::add16(V::add16(base, V::template shl16<1>(V::sub16(V::template shl16<2>(g.h1), g.h2))), g.v2);
+    i16 vert = V::add16(V::add16(base, V::template shl16<1>(V::sub16(V::template shl16<2>(g.v1), g.v2))), g.h2);
+
+    cross = V::fixed_q4(cross);
+    opposite = V::fixed_q4(opposite);
+    horiz = V::fixed_q4(horiz);
+    vert = V::fixed_q4(vert);
+
+    if (bg_row)
+        return { V::merge(vert, opposite), V::merge(g.c, cross), V::merge(horiz, rb.c) };
+    else
+        return { V::merge(rb.c, horiz), V::merge(cross, g.c), V::merge(opposite, vert) };
+}
+
+#undef DEBAYER_INLINE
+
+template<typename V, bool in_BGR, int num_output_channels = 3>
+void debayer_malvar_simd(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                         int stride, int y0, int y1)
+{
+    for (int y = y0; y < y1; y++)
+    {
+        const uint8_t* rows[5];
+        for (int k = 0; k < 5; k++)
+        {
+            int i = y + k - 2;
+            rows[k] = input + (i < 0 ? -i : i >= H ? 2 * (H - 1) - i : i) * W;
+        }
+        uint8_t* dest = buf + y * stride;
+        bool bg_row = y & 1;
+
+        for_each_wide_column<V>(W, [&](int x) {
+            bayer_planes<V> p = bg_row ? malvar<V, true>(rows, x) : malvar<V, false>(rows, x);
+            typename V::u8 first = in_BGR ? p.b : p.r, third = in_BGR ? p.r : p.b;
+            if (num_output_channels == 4)
+                V::store4(dest + x * num_output_channels, first, p.g, third);
+            else
+                V::store3(dest + x * num_output_channels, first, p.g, third);
+        }, [&](int x) {
+            rgb_px p = malvar(rows, W, x, bg_row);
+            uint8_t* px = dest + x * num_output_channels;
+            px[0] = (uint8_t)(in_BGR ? p.b : p.r);
+            px[1] = (uint8_t)p.g;
+            px[2] = (uint8_t)(in_BGR ? p.r : p.b);
+            if (num_output_channels == 4)
+                px[3] = 0xff;
+        });
+
+        memcpy(dest, dest + num_output_channels, num_output_channels);
+        memcpy(dest + (W - 1) * num_output_channels, dest + (W - 2) * num_output_channels, num_output_channels);
+    }
+
+    fill_edge_rows(H, stride, W * num_output_channels, buf, y0, y1);
+}
+
+} // anonymous ns
+} // ns ps3eye::detail
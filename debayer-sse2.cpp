@@ -0,0 +1,193 @@
+#include "debayer.hpp"
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+
+#include "debayer-simd.hpp"
+#include <emmintrin.h>
+
+namespace ps3eye::detail {
+namespace {
+
+struct sse2
+{
+    using u8 = __m128i;
+    static constexpr int N = 16;
+
+    static u8 load(const uint8_t* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void store(uint8_t* p, u8 a) { _mm_storeu_si128((__m128i*)p, a); }
+
+    static u8 avg(u8 a, u8 b) { return _mm_avg_epu8(a, b); }
+
+    static u8 avg4(u8 a, u8 b, u8 c, u8 d)
+    {
+        const __m128i zero = _mm_setzero_si128(), two = _mm_set1_epi16(2);
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)),
+                                   _mm_add_epi16(_mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(d, zero)));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)),
+                                   _mm_add_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(d, zero)));
+        lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+        hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    static u8 odd_lanes() { return _mm_set1_epi16(0x00ff); }
+    static u8 select(u8 mask, u8 a, u8 b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+
+    static u8 gray(u8 r, u8 g, u8 b)
+    {
+        // The largest sum is 255 * 256, which still fits in 16 bits.
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i kr = _mm_set1_epi16(77), kg = _mm_set1_epi16(151), kb = _mm_set1_epi16(28);
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(r, zero), kr),
+                                                 _mm_mullo_epi16(_mm_unpacklo_epi8(g, zero), kg)),
+                                   _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), kb));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(r, zero), kr),
+                                                 _mm_mullo_epi16(_mm_unpackhi_epi8(g, zero), kg)),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), kb));
+        return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+    }
+
+    // Store four a-b-c-0 pixels as 12 bytes.
+    static void store_px4(uint8_t* p, __m128i x)
+    {
+        const __m128i lo24 = _mm_set1_epi64x(0x0000000000ffffff);
+        const __m128i hi24 = _mm_set1_epi64x(0x0000ffffff000000);
+        const __m128i lo64 = _mm_set_epi64x(0, -1);
+
+        // two pixels per 64-bit half: a0 b0 c0 0 a1 b1 c1 0 -> a0 b0 c0 a1 b1 c1 0 0
+        x = _mm_or_si128(_mm_and_si128(x, lo24), _mm_and_si128(_mm_srli_epi64(x, 8), hi24));
+        // move the upper six bytes down next to the lower six
+        x = _mm_or_si128(_mm_and_si128(x, lo64), _mm_srli_si128(_mm_andnot_si128(lo64, x), 2));
+
+        _mm_storel_epi64((__m128i*)p, x);
+        int tail = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+        memcpy(p + 8, &tail, 4);
+    }
+
+    static void store3(uint8_t* p, u8 a, u8 b, u8 c)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i ab_lo = _mm_unpacklo_epi8(a, b), ab_hi = _mm_unpackhi_epi8(a, b);
+        __m128i c0_lo = _mm_unpacklo_epi8(c, zero), c0_hi = _mm_unpackhi_epi8(c, zero);
+
+        store_px4(p, _mm_unpacklo_epi16(ab_lo, c0_lo));
+        store_px4(p + 12, _mm_unpackhi_epi16(ab_lo, c0_lo));
+        store_px4(p + 24, _mm_unpacklo_epi16(ab_hi, c0_hi));
+        store_px4(p + 36, _mm_unpackhi_epi16(ab_hi, c0_hi));
+    }
+
+    static void store4(uint8_t* p, u8 a, u8 b, u8 c)
+    {
+        const __m128i alpha = _mm_set1_epi8(-1);
+        __m128i ab_lo = _mm_unpacklo_epi8(a, b), ab_hi = _mm_unpackhi_epi8(a, b);
+        __m128i ca_lo = _mm_unpacklo_epi8(c, alpha), ca_hi = _mm_unpackhi_epi8(c, alpha);
+
+        _mm_storeu_si128((__m128i*)p + 0, _mm_unpacklo_epi16(ab_lo, ca_lo));
+        _mm_storeu_si128((__m128i*)p + 1, _mm_unpackhi_epi16(ab_lo, ca_lo));
+        _mm_storeu_si128((__m128i*)p + 2, _mm_unpacklo_epi16(ab_hi, ca_hi));
+        _mm_storeu_si128((__m128i*)p + 3, _mm_unpackhi_epi16(ab_hi, ca_hi));
+    }
+
+    // The largest sum is 56228, unsigned 16 bits are enough.
+    static u8 luma(u8 r, u8 g, u8 b)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i kr = _mm_set1_epi16(66), kg = _mm_set1_epi16(129), kb = _mm_set1_epi16(25);
+        const __m128i round = _mm_set1_epi16(128), offset = _mm_set1_epi16(16);
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(r, zero), kr),
+                                                 _mm_mullo_epi16(_mm_unpacklo_epi8(g, zero), kg)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), kb), round));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(r, zero), kr),
+                                                 _mm_mullo_epi16(_mm_unpackhi_epi8(g, zero), kg)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), kb), round));
+        lo = _mm_add_epi16(_mm_srli_epi16(lo, 8), offset);
+        hi = _mm_add_epi16(_mm_srli_epi16(hi, 8), offset);
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    // At most 112 * 255 + 128 either way, signed 16 bits are enough.
+    template<int kr, int kg, int kb>
+    static u8 chroma(u8 r, u8 g, u8 b)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(128);
+        const __m128i mr = _mm_set1_epi16(kr), mg = _mm_set1_epi16(kg), mb = _mm_set1_epi16(kb);
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(r, zero), mr),
+                                                 _mm_mullo_epi16(_mm_unpacklo_epi8(g, zero), mg)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), mb), round));
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(r, zero), mr),
+                                                 _mm_mullo_epi16(_mm_unpackhi_epi8(g, zero), mg)),
+                                   _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), mb), round));
+        lo = _mm_add_epi16(_mm_srai_epi16(lo, 8), round);
+        hi = _mm_add_epi16(_mm_srai_epi16(hi, 8), round);
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    static __m128i pair_sums(u8 a)
+    {
+        const __m128i even = _mm_set1_epi16(0x00ff);
+        return _mm_add_epi16(_mm_and_si128(a, even), _mm_srli_epi16(a, 8));
+    }
+
+    static u8 quad_avg(u8 a0, u8 a1, u8 b0, u8 b1)
+    {
+        const __m128i two = _mm_set1_epi16(2);
+        __m128i lo = _mm_add_epi16(_mm_add_epi16(pair_sums(a0), pair_sums(b0)), two);
+        __m128i hi = _mm_add_epi16(_mm_add_epi16(pair_sums(a1), pair_sums(b1)), two);
+        return _mm_packus_epi16(_mm_srli_epi16(lo, 2), _mm_srli_epi16(hi, 2));
+    }
+
+    static void zip(u8 a, u8 b, u8& lo, u8& hi)
+    {
+        lo = _mm_unpacklo_epi8(a, b);
+        hi = _mm_unpackhi_epi8(a, b);
+    }
+
+    static void unzip(u8 a0, u8 a1, u8& even, u8& odd)
+    {
+        const __m128i mask = _mm_set1_epi16(0x00ff);
+        even = _mm_packus_epi16(_mm_and_si128(a0, mask), _mm_and_si128(a1, mask));
+        odd = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+    }
+
+    using i16 = __m128i;
+
+    static i16 widen_even(u8 a) { return _mm_and_si128(a, _mm_set1_epi16(0x00ff)); }
+    static i16 widen_odd(u8 a) { return _mm_srli_epi16(a, 8); }
+    static i16 add16(i16 a, i16 b) { return _mm_add_epi16(a, b); }
+    static i16 sub16(i16 a, i16 b) { return _mm_sub_epi16(a, b); }
+    template<int n> static i16 shl16(i16 a) { return _mm_slli_epi16(a, n); }
+
+    static i16 fixed_q4(i16 a)
+    {
+        a = _mm_srai_epi16(_mm_add_epi16(a, _mm_set1_epi16(8)), 4);
+        return _mm_min_epi16(_mm_max_epi16(a, _mm_setzero_si128()), _mm_set1_epi16(255));
+    }
+
+    static u8 merge(i16 even, i16 odd) { return _mm_or_si128(even, _mm_slli_epi16(odd, 8)); }
+};
+
+} // anonymous ns
+
+const debayer_impl* debayer_sse2()
+{
+    static const debayer_impl impl = {
+        "sse2", debayer_gray_simd<sse2>, debayer_rgb_simd<sse2, true>, debayer_rgb_simd<sse2, false>,
+        debayer_rgb_simd<sse2, true, 4>, debayer_rgb_simd<sse2, false, 4>,
+        debayer_yuv_simd<sse2, yuv_layout::nv12>, debayer_yuv_simd<sse2, yuv_layout::i420>,
+        debayer_yuv_simd<sse2, yuv_layout::yuyv>,
+        { debayer_binned_simd<sse2, 1>, debayer_binned_simd<sse2, 3, true>, debayer_binned_simd<sse2, 3, false>,
+          debayer_binned_simd<sse2, 4, true>, debayer_binned_simd<sse2, 4, false> },
+        { debayer_malvar_simd<sse2, true>, debayer_malvar_simd<sse2, false>,
+          debayer_malvar_simd<sse2, true, 4>, debayer_malvar_simd<sse2, false, 4> },
+    };
+    return &impl;
+}
+
+} // ns ps3eye::detail
+
+#else
+
+const ps3eye::detail::debayer_impl* ps3eye::detail::debayer_sse2() { return nullptr; }
+
+#endif
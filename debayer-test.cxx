@@ -0,0 +1,385 @@
+#include "debayer.hpp"
+#include "queue.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+using ps3eye::detail::debayer_impl;
+using ps3eye::detail::debayer_fn;
+using ps3eye::detail::yuv_layout;
+using ps3eye::detail::frame_output;
+using ps3eye::format;
+using ps3eye::output_scale;
+
+// Compare `rows` rows of `row_bytes` bytes, and check that the padding up
+// to `stride` was left alone.
+static bool compare_rows(const char* name, const char* fmt, int W, int H, int bpp,
+                         const uint8_t* expected, const uint8_t* actual, int stride,
+                         int row_bytes, int rows)
+{
+    for (int y = 0; y < rows; y++)
+        for (int i = 0; i < stride; i++)
+        {
+            int want = i < row_bytes ? expected[y * row_bytes + i] : 0xcd;
+            if (actual[y * stride + i] != want)
+            {
+                fprintf(stderr, "[FAIL] %s %s %dx%d stride %d: pixel (%d, %d) channel %d is %d, expected %d\n",
+                        name, fmt, W, H, stride, i / bpp, y, i % bpp, actual[y * stride + i], want);
+                return false;
+            }
+        }
+
+    return true;
+}
+
+static bool compare(const char* name, const char* fmt, debayer_fn ref, debayer_fn fn,
+                    int W, int H, int bpp, int stride, const std::vector<uint8_t>& bayer)
+{
+    // prefill so that pixels one kernel forgets to write show up
+    std::vector<uint8_t> expected(unsigned(W * H * bpp), 0xcd), actual(unsigned(stride * H), 0xcd);
+
+    ref(W, H, bayer.data(), expected.data(), W * bpp, 1, H - 1);
+
+    // convert in bands of random height so that seams get checked too
+    static std::mt19937 rng(0x4559);
+    for (int y0 = 1, y1; y0 < H - 1; y0 = y1)
+    {
+        y1 = std::min(H - 1, y0 + std::uniform_int_distribution<int>(1, 5)(rng));
+        fn(W, H, bayer.data(), actual.data(), stride, y0, y1);
+    }
+
+    return compare_rows(name, fmt, W, H, bpp, expected.data(), actual.data(), stride, W * bpp, H);
+}
+
+// Binned output against the quads straight from the Bayer data.
+static bool compare_binned(const char* name, const char* fmt, debayer_fn fn, int W, int H,
+                           int bpp, bool in_BGR, int stride, const std::vector<uint8_t>& bayer)
+{
+    const int w = W / 2, h = H / 2;
+    std::vector<uint8_t> expected(unsigned(w * h * bpp)), actual(unsigned(stride * h), 0xcd);
+
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            int G0 = bayer[unsigned(2*y * W + 2*x)], R = bayer[unsigned(2*y * W + 2*x + 1)];
+            int B = bayer[unsigned((2*y + 1) * W + 2*x)], G1 = bayer[unsigned((2*y + 1) * W + 2*x + 1)];
+            int G = (G0 + G1 + 1) >> 1;
+            uint8_t* px = &expected[unsigned((y * w + x) * bpp)];
+
+            if (bpp == 1)
+                px[0] = uint8_t((R * 77 + G * 151 + B * 28) >> 8);
+            else
+            {
+                px[0] = uint8_t(in_BGR ? B : R);
+                px[1] = uint8_t(G);
+                px[2] = uint8_t(in_BGR ? R : B);
+                if (bpp == 4)
+                    px[3] = 0xff;
+            }
+        }
+
+    // bands can start anywhere
+    static std::mt19937 rng(0x42494e);
+    for (int y0 = 0, y1; y0 < h; y0 = y1)
+    {
+        y1 = std::min(h, y0 + std::uniform_int_distribution<int>(1, 5)(rng));
+        fn(W, H, bayer.data(), actual.data(), stride, y0, y1);
+    }
+
+    return compare_rows(name, fmt, w, h, bpp, expected.data(), actual.data(), stride, w * bpp, h);
+}
+
+// The 32-bit formats are the 24-bit ones plus alpha.
+static bool check_alpha(const char* fmt, debayer_fn bgr_fn, debayer_fn bgra_fn, int W, int H,
+                        const std::vector<uint8_t>& bayer)
+{
+    std::vector<uint8_t> bgr(unsigned(W * H * 3)), bgra(unsigned(W * H * 4));
+    bgr_fn(W, H, bayer.data(), bgr.data(), W * 3, 1, H - 1);
+    bgra_fn(W, H, bayer.data(), bgra.data(), W * 4, 1, H - 1);
+
+    for (int i = 0; i < W * H; i++)
+        if (memcmp(&bgr[unsigned(i * 3)], &bgra[unsigned(i * 4)], 3) || bgra[unsigned(i * 4 + 3)] != 0xff)
+        {
+            fprintf(stderr, "[FAIL] scalar %s %dx%d: pixel (%d, %d) isn't bgr plus alpha\n", fmt, W, H, i % W, i / W);
+            return false;
+        }
+
+    return true;
+}
+
+// Gradient correction must leave a flat color alone, edges included.
+static bool check_flat(int W, int H)
+{
+    const debayer_impl& ref = ps3eye::detail::debayer_scalar();
+    const uint8_t R = 200, G = 90, B = 17;
+    std::vector<uint8_t> bayer(unsigned(W * H)), bgr(unsigned(W * H * 3)), rgb(bgr.size());
+
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            bayer[unsigned(y * W + x)] = y % 2 == 0 ? (x % 2 == 0 ? G : R) : (x % 2 == 0 ? B : G);
+
+    ref.malvar.bgr(W, H, bayer.data(), bgr.data(), W * 3, 1, H - 1);
+    ref.malvar.rgb(W, H, bayer.data(), rgb.data(), W * 3, 1, H - 1);
+
+    for (int i = 0; i < W * H; i++)
+    {
+        const uint8_t* b = &bgr[unsigned(i * 3)];
+        const uint8_t* r = &rgb[unsigned(i * 3)];
+        if (b[0] != B || b[1] != G || b[2] != R || r[0] != R || r[1] != G || r[2] != B)
+        {
+            fprintf(stderr, "[FAIL] scalar malvar %dx%d: flat pixel (%d, %d) is %d %d %d\n",
+                    W, H, i % W, i / W, b[2], b[1], b[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// BT.601 studio range straight from BGR, written independently of the kernels
+static void bgr_to_yuv(const uint8_t* bgr, int W, int H, yuv_layout layout, std::vector<uint8_t>& out)
+{
+    auto px = [&](int x, int y, int ch) { return int(bgr[(y * W + x) * 3 + 2 - ch]); };
+    auto Y = [](int r, int g, int b) { return uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16); };
+    auto U = [](int r, int g, int b) { return uint8_t(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128); };
+    auto V = [](int r, int g, int b) { return uint8_t(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128); };
+
+    if (layout == yuv_layout::yuyv)
+    {
+        out.assign(unsigned(W * H * 2), 0);
+        for (int y = 0; y < H; y++)
+            for (int x = 0; x < W; x += 2)
+            {
+                int c[3];
+                for (int ch = 0; ch < 3; ch++)
+                    c[ch] = (px(x, y, ch) + px(x + 1, y, ch) + 1) >> 1;
+                uint8_t* dest = &out[unsigned((y * W + x) * 2)];
+                dest[0] = Y(px(x, y, 0), px(x, y, 1), px(x, y, 2));
+                dest[1] = U(c[0], c[1], c[2]);
+                dest[2] = Y(px(x + 1, y, 0), px(x + 1, y, 1), px(x + 1, y, 2));
+                dest[3] = V(c[0], c[1], c[2]);
+            }
+        return;
+    }
+
+    out.assign(unsigned(W * H * 3 / 2), 0);
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            out[unsigned(y * W + x)] = Y(px(x, y, 0), px(x, y, 1), px(x, y, 2));
+
+    const int cw = W / 2, ch = H / 2;
+    for (int y = 0; y < ch; y++)
+        for (int x = 0; x < cw; x++)
+        {
+            int c[3];
+            for (int k = 0; k < 3; k++)
+                c[k] = (px(2*x, 2*y, k) + px(2*x + 1, 2*y, k) + px(2*x, 2*y + 1, k) + px(2*x + 1, 2*y + 1, k) + 2) >> 2;
+            uint8_t u = U(c[0], c[1], c[2]), v = V(c[0], c[1], c[2]);
+            if (layout == yuv_layout::nv12)
+            {
+                out[unsigned(W * H + y * W + 2*x)] = u;
+                out[unsigned(W * H + y * W + 2*x + 1)] = v;
+            }
+            else
+            {
+                out[unsigned(W * H + y * cw + x)] = u;
+                out[unsigned(W * H + cw * ch + y * cw + x)] = v;
+            }
+        }
+}
+
+static bool compare_yuv(const char* name, const char* fmt, yuv_layout layout, debayer_fn fn,
+                        int W, int H, int stride, const std::vector<uint8_t>& bayer)
+{
+    std::vector<uint8_t> bgr(unsigned(W * H * 3)), expected;
+    ps3eye::detail::debayer_scalar().bgr(W, H, bayer.data(), bgr.data(), W * 3, 1, H - 1);
+    bgr_to_yuv(bgr.data(), W, H, layout, expected);
+
+    std::vector<uint8_t> actual(unsigned(stride * H * 2), 0xcd);
+
+    // 4:2:0 bands have to hold whole row pairs
+    static std::mt19937 rng(0x595556);
+    for (int y0 = 1, y1; y0 < H - 1; y0 = y1)
+    {
+        int step = std::uniform_int_distribution<int>(1, 5)(rng);
+        if (layout != yuv_layout::yuyv)
+            step = step / 2 * 2 + 2 - (y0 & 1);
+        y1 = std::min(H - 1, y0 + step);
+        fn(W, H, bayer.data(), actual.data(), stride, y0, y1);
+    }
+
+    if (layout == yuv_layout::yuyv)
+        return compare_rows(name, fmt, W, H, 2, expected.data(), actual.data(), stride, W * 2, H);
+
+    const uint8_t* chroma = expected.data() + W * H;
+    bool ret = compare_rows(name, fmt, W, H, 1, expected.data(), actual.data(), stride, W, H);
+    if (layout == yuv_layout::nv12)
+        return ret && compare_rows(name, fmt, W, H, 2, chroma, actual.data() + stride * H, stride, W, H / 2);
+
+    const uint8_t* u = actual.data() + stride * H;
+    const uint8_t* v = u + stride / 2 * (H / 2);
+    return ret && compare_rows(name, fmt, W, H, 1, chroma, u, stride / 2, W / 2, H / 2) &&
+           compare_rows(name, fmt, W, H, 1, chroma + W / 2 * (H / 2), v, stride / 2, W / 2, H / 2);
+}
+
+// Regions of interest against the whole frame converted the same way:
+// pixels inside match, pixels outside are left alone.
+static bool compare_rois(ps3eye::detail::frame_queue& queue, const char* fmt, format f, int bpp,
+                         output_scale scale, ps3eye::demosaic method, int W, int H,
+                         const std::vector<uint8_t>& bayer)
+{
+    const int w = scale == output_scale::half ? W / 2 : W, h = scale == output_scale::half ? H / 2 : H;
+    const int stride = w * bpp;
+    std::vector<uint8_t> expected(unsigned(stride * h)), actual(expected.size(), 0xcd);
+
+    queue.convert(bayer.data(), expected.data(), W, H, frame_output{ f, stride, scale, method });
+
+    // odd and even corners, ones at the edges, and one hanging off the frame
+    static std::mt19937 rng(0x524f);
+    ps3eye::frame_roi rois[4];
+    for (ps3eye::frame_roi& r : rois)
+    {
+        r.x = std::uniform_int_distribution<int>(0, w - 1)(rng);
+        r.y = std::uniform_int_distribution<int>(0, h - 1)(rng);
+        r.width = std::uniform_int_distribution<int>(1, std::max(1, w / 3))(rng);
+        r.height = std::uniform_int_distribution<int>(1, std::max(1, h / 3))(rng);
+    }
+    rois[1].x = rois[1].y = 0;
+    rois[2].x = w - rois[2].width, rois[2].y = h - rois[2].height;
+    rois[3].x = -3, rois[3].width += w;
+
+    queue.convert(bayer.data(), actual.data(), W, H, frame_output{ f, stride, scale, method, rois, 4 });
+
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+        {
+            bool inside = false;
+            for (const ps3eye::frame_roi& r : rois)
+            {
+                int x0 = r.x, x1 = r.x + r.width;
+                if (f == format::YUYV)
+                    x0 &= ~1, x1 += x1 & 1;
+                inside |= x >= x0 && x < x1 && y >= r.y && y < r.y + r.height;
+            }
+            for (int c = 0; c < bpp; c++)
+            {
+                int i = y * stride + x * bpp + c;
+                int want = inside ? expected[unsigned(i)] : 0xcd;
+                if (actual[unsigned(i)] != want)
+                {
+                    fprintf(stderr, "[FAIL] roi %s%s %dx%d: pixel (%d, %d) channel %d is %d, expected %d\n",
+                            fmt, scale == output_scale::half ? " half" : "", W, H, x, y, c, actual[unsigned(i)], want);
+                    return false;
+                }
+            }
+        }
+
+    return true;
+}
+
+int main(void)
+{
+    static const int sizes[][2] = {
+        { 640, 480 }, { 320, 240 },
+        { 4, 3 }, { 18, 5 }, { 34, 4 }, { 36, 7 }, { 66, 6 }, { 98, 9 }, { 130, 10 },
+    };
+
+    std::mt19937 rng(0x5053);
+    std::uniform_int_distribution<int> dist(0, 255);
+
+    const debayer_impl& ref = ps3eye::detail::debayer_scalar();
+    bool ret = true;
+
+    for (const debayer_impl* impl : ps3eye::detail::debayer_impls())
+    {
+        bool status = true;
+
+        for (auto [ W, H ] : sizes)
+            for (int iter = 0; iter < 4; iter++)
+            {
+                std::vector<uint8_t> bayer(unsigned(W * H));
+                for (uint8_t& x : bayer)
+                    x = (uint8_t)dist(rng);
+                // make sure the extremes get hit as well
+                if (iter == 1)
+                    memset(bayer.data(), 0xff, bayer.size());
+
+                // packed, and padded to 64 bytes with at least a byte to spare
+                for (int pad : { 0, 1 })
+                {
+                    auto stride = [&](int bpp) { return pad ? (W * bpp + 64) & ~63 : W * bpp; };
+
+                    status &= compare(impl->name, "gray", ref.gray, impl->gray, W, H, 1, stride(1), bayer);
+                    status &= compare(impl->name, "bgr", ref.bgr, impl->bgr, W, H, 3, stride(3), bayer);
+                    status &= compare(impl->name, "rgb", ref.rgb, impl->rgb, W, H, 3, stride(3), bayer);
+                    status &= compare(impl->name, "bgra", ref.bgra, impl->bgra, W, H, 4, stride(4), bayer);
+                    status &= compare(impl->name, "rgba", ref.rgba, impl->rgba, W, H, 4, stride(4), bayer);
+                    status &= compare(impl->name, "malvar bgr", ref.malvar.bgr, impl->malvar.bgr, W, H, 3, stride(3), bayer);
+                    status &= compare(impl->name, "malvar rgb", ref.malvar.rgb, impl->malvar.rgb, W, H, 3, stride(3), bayer);
+                    status &= compare(impl->name, "malvar bgra", ref.malvar.bgra, impl->malvar.bgra, W, H, 4, stride(4), bayer);
+                    status &= compare(impl->name, "malvar rgba", ref.malvar.rgba, impl->malvar.rgba, W, H, 4, stride(4), bayer);
+
+                    if (W % 2 == 0)
+                        status &= compare_yuv(impl->name, "yuyv", yuv_layout::yuyv, impl->yuyv, W, H, stride(2), bayer);
+                    if (W % 2 == 0 && H % 2 == 0)
+                    {
+                        status &= compare_yuv(impl->name, "nv12", yuv_layout::nv12, impl->nv12, W, H, stride(1), bayer);
+                        status &= compare_yuv(impl->name, "i420", yuv_layout::i420, impl->i420, W, H, stride(1), bayer);
+
+                        auto half = [&](int bpp) { return pad ? (W / 2 * bpp + 64) & ~63 : W / 2 * bpp; };
+                        const auto& bin = impl->binned;
+                        status &= compare_binned(impl->name, "binned gray", bin.gray, W, H, 1, true, half(1), bayer);
+                        status &= compare_binned(impl->name, "binned bgr", bin.bgr, W, H, 3, true, half(3), bayer);
+                        status &= compare_binned(impl->name, "binned rgb", bin.rgb, W, H, 3, false, half(3), bayer);
+                        status &= compare_binned(impl->name, "binned bgra", bin.bgra, W, H, 4, true, half(4), bayer);
+                        status &= compare_binned(impl->name, "binned rgba", bin.rgba, W, H, 4, false, half(4), bayer);
+                    }
+                }
+
+                if (impl == &ref)
+                {
+                    status &= check_alpha("bgra", ref.bgr, ref.bgra, W, H, bayer);
+                    status &= check_alpha("malvar bgra", ref.malvar.bgr, ref.malvar.bgra, W, H, bayer);
+                    if (iter == 0)
+                        status &= check_flat(W, H);
+                }
+            }
+
+        printf("[%s] %s\n", status ? "GOOD" : "FAIL", impl->name);
+        ret &= status;
+    }
+
+    // with the fastest kernels, on a couple of threads
+    auto queue = std::make_unique<ps3eye::detail::frame_queue>();
+    queue->set_debayer_threads(2);
+    const auto bilinear = ps3eye::demosaic::bilinear, malvar = ps3eye::demosaic::malvar;
+    bool status = true;
+
+    for (auto [ W, H ] : sizes)
+        for (int iter = 0; iter < 4 && W % 2 == 0 && H % 2 == 0; iter++)
+        {
+            std::vector<uint8_t> bayer(unsigned(W * H));
+            for (uint8_t& x : bayer)
+                x = (uint8_t)dist(rng);
+
+            status &= compare_rois(*queue, "bayer", format::Bayer, 1, output_scale::full, bilinear, W, H, bayer);
+            status &= compare_rois(*queue, "gray", format::Gray, 1, output_scale::full, bilinear, W, H, bayer);
+            status &= compare_rois(*queue, "bgr", format::BGR, 3, output_scale::full, bilinear, W, H, bayer);
+            status &= compare_rois(*queue, "rgba", format::RGBA, 4, output_scale::full, bilinear, W, H, bayer);
+            status &= compare_rois(*queue, "yuyv", format::YUYV, 2, output_scale::full, bilinear, W, H, bayer);
+            status &= compare_rois(*queue, "malvar bgr", format::BGR, 3, output_scale::full, malvar, W, H, bayer);
+            status &= compare_rois(*queue, "malvar rgba", format::RGBA, 4, output_scale::full, malvar, W, H, bayer);
+            status &= compare_rois(*queue, "gray", format::Gray, 1, output_scale::half, bilinear, W, H, bayer);
+            status &= compare_rois(*queue, "bgr", format::BGR, 3, output_scale::half, bilinear, W, H, bayer);
+        }
+
+    printf("[%s] regions of interest\n", status ? "GOOD" : "FAIL");
+    ret &= status;
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
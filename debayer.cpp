@@ -0,0 +1,573 @@
+#include "debayer.hpp"
+
+#include <algorithm>
+
+#if defined _MSC_VER && (defined _M_IX86 || defined _M_X64)
+#   include <intrin.h>
+#endif
+
+namespace ps3eye::detail {
+
+static void debayer_gray(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                         int stride, int y0, int y1)
+{
+    // PSMove output is in the following Bayer format (GRBG):
+    //
+    // G R G R G R
+    // B G B G B G
+    // G R G R G R
+    // B G B G B G
+    //
+    // This is the normal Bayer pattern shifted left one place.
+
+    int source_stride = W;
+    const uint8_t* source_row = input + (y0 - 1) * source_stride; // Start at first bayer pixel
+    int dest_stride = stride;
+    uint8_t* dest_row = buf + y0 * dest_stride + 1; // We start outputting
+    // at the second pixel
+    // of the second row's
+    // G component
+    uint32_t R, G, B;
+
+    // Fill rows y0 to y1-1 of the destination buffer. First and last row
+    // are filled separately (they are copied from the second row and
+    // second-to-last rows respectively)
+    for (int y = y0 - 1; y < y1 - 1;
+         source_row += source_stride, dest_row += dest_stride, ++y)
+    {
+        const uint8_t* source = source_row;
+        // -2 to deal with the fact that we're starting at the second pixel of
+        // the row and should end at the second-to-last pixel of the row
+        // (first and last are filled separately)
+        const uint8_t* source_end =
+            source + (source_stride - 2);
+        uint8_t* dest = dest_row;
+
+        // Row starting with Green
+        if (y % 2 == 0)
+        {
+            // Fill first pixel (green)
+            B = (source[source_stride] + source[source_stride + 2] + 1) >> 1;
+            G = source[source_stride + 1];
+            R = (source[1] + source[source_stride * 2 + 1] + 1) >> 1;
+            *dest = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+
+            source++;
+            dest++;
+
+            // Fill remaining pixel
+            for (; source <= source_end - 2; source += 2, dest += 2)
+            {
+                // Blue pixel
+                B = source[source_stride + 1];
+                G = (source[1] + source[source_stride] + source[source_stride + 2] +
+                     source[source_stride * 2 + 1] + 2) >> 2;
+                R = (source[0] + source[2] + source[source_stride * 2] +
+                     source[source_stride * 2 + 2] + 2) >> 2;
+                dest[0] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+
+                //  Green pixel
+                B = (source[source_stride + 1] + source[source_stride + 3] + 1) >> 1;
+                G = source[source_stride + 2];
+                R = (source[2] + source[source_stride * 2 + 2] + 1) >> 1;
+                dest[1] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+            }
+        }
+        else
+        {
+            for (; source <= source_end - 2; source += 2, dest += 2)
+            {
+                // Red pixel
+                B = (source[0] + source[2] + source[source_stride * 2] +
+                     source[source_stride * 2 + 2] + 2) >> 2;
+
+                G = (source[1] + source[source_stride] + source[source_stride + 2] +
+                     source[source_stride * 2 + 1] + 2) >> 2;
+
+                R = source[source_stride + 1];
+                dest[0] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+
+                // Green pixel
+                B = (source[2] + source[source_stride * 2 + 2] + 1) >> 1;
+                G = source[source_stride + 2];
+                R = (source[source_stride + 1] + source[source_stride + 3] + 1) >> 1;
+                dest[1] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+            }
+        }
+
+        if (source < source_end)
+        {
+            B = source[source_stride + 1];
+            G = (source[1] + source[source_stride] + source[source_stride + 2] +
+                 source[source_stride * 2 + 1] + 2) >> 2;
+            R = (source[0] + source[2] + source[source_stride * 2] +
+                 source[source_stride * 2 + 2] + 2) >> 2;
+
+            dest[0] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+
+            //source++;
+            //dest++;
+        }
+
+        // Fill first pixel of row (copy second pixel)
+        uint8_t* first_pixel = dest_row - 1;
+        first_pixel[0] = dest_row[0];
+
+        // Fill last pixel of row (copy second-to-last pixel). Note: dest row
+        // starts at the *second* pixel of the row, so dest_row + (width-2)
+        // * num_output_channels puts us at the last pixel of the row
+        uint8_t* last_pixel = dest_row + (W - 2);
+        uint8_t* second_to_last_pixel = last_pixel - 1;
+        last_pixel[0] = second_to_last_pixel[0];
+    }
+
+    // Fill first & last row, if they're next to this band
+    for (int i = 0; i < W; i++)
+    {
+        if (y0 == 1)
+            buf[i] = buf[i + dest_stride];
+        if (y1 == H - 1)
+            buf[i + (H - 1) * dest_stride] = buf[i + (H - 2) * dest_stride];
+    }
+}
+
+template<bool in_BGR, int num_output_channels = 3, int swap_br = in_BGR ? 1 : -1>
+static void debayer_rgb(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                        int stride, int y0, int y1)
+{
+    // PSMove output is in the following Bayer format (GRBG):
+    //
+    // G R G R G R
+    // B G B G B G
+    // G R G R G R
+    // B G B G B G
+    //
+    // This is the normal Bayer pattern shifted left one place.
+
+    int source_stride = W;
+    const uint8_t* source_row = input + (y0 - 1) * source_stride; // Start at first bayer pixel
+    int dest_stride = stride;
+    // We start outputting at the second pixel of the
+    uint8_t* dest_row = buf + y0 * dest_stride + num_output_channels + 1;
+    // second row's G component
+
+    // Fill rows y0 to y1-1 of the destination buffer. First and last row
+    // are filled separately (they are copied from the second row and
+    // second-to-last rows respectively)
+    for (int y = y0 - 1; y < y1 - 1;
+         source_row += source_stride, dest_row += dest_stride, ++y)
+    {
+        const uint8_t* source = source_row;
+        // -2 to deal with the fact that we're starting at the second pixel of
+        // the row and should end at the second-to-last pixel of the row
+        // (first and last are filled separately)
+        const uint8_t* source_end = source + (source_stride - 2);
+        uint8_t* dest = dest_row;
+
+        // Row starting with Green
+        if (y % 2 == 0)
+        {
+            // Fill first pixel (green)
+            dest[-1 * swap_br] =
+                (source[source_stride] + source[source_stride + 2] + 1) >> 1;
+            dest[0] = source[source_stride + 1];
+            dest[1 * swap_br] = (source[1] + source[source_stride * 2 + 1] + 1) >> 1;
+
+            source++;
+            dest += num_output_channels;
+
+            // Fill remaining pixel
+            for (; source <= source_end - 2; source += 2, dest += num_output_channels * 2)
+            {
+                // Blue pixel
+                uint8_t* cur_pixel = dest;
+                cur_pixel[-1 * swap_br] = source[source_stride + 1];
+                cur_pixel[0] = (source[1] + source[source_stride] +
+                                source[source_stride + 2] +
+                                source[source_stride * 2 + 1] + 2) >> 2;
+                cur_pixel[1 * swap_br] =
+                    (source[0] + source[2] + source[source_stride * 2] +
+                     source[source_stride * 2 + 2] + 2) >> 2;
+
+                //  Green pixel
+                uint8_t* next_pixel = cur_pixel + num_output_channels;
+                next_pixel[-1 * swap_br] =
+                    (source[source_stride + 1] + source[source_stride + 3] + 1) >> 1;
+                next_pixel[0] = source[source_stride + 2];
+                next_pixel[1 * swap_br] =
+                    (source[2] + source[source_stride * 2 + 2] + 1) >> 1;
+            }
+        }
+        else
+        {
+            for (; source <= source_end - 2; source += 2, dest += num_output_channels * 2)
+            {
+                // Red pixel
+                uint8_t* cur_pixel = dest;
+                cur_pixel[-1 * swap_br] =
+                    (source[0] + source[2] + source[source_stride * 2] +
+                     source[source_stride * 2 + 2] + 2) >> 2;
+
+                cur_pixel[0] =
+                    (source[1] + source[source_stride] +
+                     source[source_stride + 2] +
+                     source[source_stride * 2 + 1] + 2) >> 2;
+
+                cur_pixel[1 * swap_br] = source[source_stride + 1];
+
+                // Green pixel
+                uint8_t* next_pixel = cur_pixel + num_output_channels;
+                next_pixel[-1 * swap_br] =
+                    (source[2] + source[source_stride * 2 + 2] + 1) >> 1;
+                next_pixel[0] = source[source_stride + 2];
+                next_pixel[1 * swap_br] =
+                    (source[source_stride + 1] + source[source_stride + 3] + 1) >> 1;
+            }
+        }
+
+        if (source < source_end)
+        {
+            dest[-1 * swap_br] = source[source_stride + 1];
+            dest[0] = (source[1] + source[source_stride] + source[source_stride + 2] +
+                       source[source_stride * 2 + 1] + 2) >> 2;
+            dest[1 * swap_br] = (source[0] + source[2] + source[source_stride * 2] +
+                                 source[source_stride * 2 + 2] + 2) >> 2;
+
+            //source++;
+            //dest += num_output_channels;
+        }
+
+        // Fill first pixel of row (copy second pixel)
+        uint8_t* first_pixel = dest_row - num_output_channels;
+        first_pixel[-1 * swap_br] = dest_row[-1 * swap_br];
+        first_pixel[0] = dest_row[0];
+        first_pixel[1 * swap_br] = dest_row[1 * swap_br];
+
+        // Fill last pixel of row (copy second-to-last pixel). Note: dest row
+        // starts at the *second* pixel of the row, so dest_row + (width-2)
+        // * num_output_channels puts us at the last pixel of the row
+        uint8_t* last_pixel = dest_row + (W - 2) * num_output_channels;
+        uint8_t* second_to_last_pixel = last_pixel - num_output_channels;
+
+        last_pixel[-1 * swap_br] = second_to_last_pixel[-1 * swap_br];
+        last_pixel[0] = second_to_last_pixel[0];
+        last_pixel[1 * swap_br] = second_to_last_pixel[1 * swap_br];
+
+        // Alpha, if any, is a constant
+        if (num_output_channels == 4)
+            for (int x = 0; x < W; x++)
+                dest_row[x * num_output_channels - num_output_channels + 2] = 0xff;
+    }
+
+    // Fill first & last row, if they're next to this band
+    for (int i = 0; i < W * num_output_channels; i++)
+    {
+        if (y0 == 1)
+            buf[i] = buf[i + dest_stride];
+        if (y1 == H - 1)
+            buf[i + (H - 1) * dest_stride] = buf[i + (H - 2) * dest_stride];
+    }
+}
+
+// What the BGR kernels output at (x, y), the copied edges included.
+static void bayer_rgb_at(int W, int H, const uint8_t* input, int x, int y,
+                         unsigned& R, unsigned& G, unsigned& B)
+{
+    x = std::clamp(x, 1, W - 2);
+    y = std::clamp(y, 1, H - 2);
+
+    const uint8_t* p = input + y * W + x;
+    unsigned center = p[0];
+    unsigned horiz = (p[-1] + p[1] + 1) >> 1;
+    unsigned vert = (p[-W] + p[W] + 1) >> 1;
+    unsigned cross = (p[-W] + p[-1] + p[1] + p[W] + 2) >> 2;
+    unsigned diag = (p[-W - 1] + p[-W + 1] + p[W - 1] + p[W + 1] + 2) >> 2;
+
+    if (y % 2 == 0)
+    {
+        if (x % 2 == 0)
+            R = horiz, G = center, B = vert;
+        else
+            R = center, G = cross, B = diag;
+    }
+    else
+    {
+        if (x % 2 == 0)
+            R = diag, G = cross, B = center;
+        else
+            R = vert, G = center, B = horiz;
+    }
+}
+
+static uint8_t yuv_y(unsigned R, unsigned G, unsigned B)
+{
+    return (uint8_t)(((66 * R + 129 * G + 25 * B + 128) >> 8) + 16);
+}
+
+static uint8_t yuv_u(int R, int G, int B)
+{
+    return (uint8_t)(((-38 * R - 74 * G + 112 * B + 128) >> 8) + 128);
+}
+
+static uint8_t yuv_v(int R, int G, int B)
+{
+    return (uint8_t)(((112 * R - 94 * G - 18 * B + 128) >> 8) + 128);
+}
+
+template<yuv_layout layout>
+static void debayer_yuv(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                        int stride, int y0, int y1)
+{
+    constexpr bool subsampled = layout != yuv_layout::yuyv;
+    const int first = y0 == 1 ? 0 : y0, last = y1 == H - 1 ? H : y1;
+
+    // RGB of the one or two rows sharing chroma
+    std::vector<uint8_t> rgb(unsigned(W * 3 * 2));
+
+    for (int y = first; y < last; y += subsampled ? 2 : 1)
+    {
+        const int rows = subsampled ? 2 : 1;
+
+        for (int k = 0; k < rows; k++)
+            for (int x = 0; x < W; x++)
+            {
+                unsigned R, G, B;
+                bayer_rgb_at(W, H, input, x, y + k, R, G, B);
+                uint8_t* px = &rgb[unsigned((k * W + x) * 3)];
+                px[0] = (uint8_t)R; px[1] = (uint8_t)G; px[2] = (uint8_t)B;
+            }
+
+        for (int c = 0; c < W / 2; c++)
+        {
+            const uint8_t* px = &rgb[unsigned(c * 2 * 3)];
+            int R, G, B;
+
+            if (subsampled)
+            {
+                const uint8_t* below = px + W * 3;
+                R = (px[0] + px[3] + below[0] + below[3] + 2) >> 2;
+                G = (px[1] + px[4] + below[1] + below[4] + 2) >> 2;
+                B = (px[2] + px[5] + below[2] + below[5] + 2) >> 2;
+            }
+            else
+            {
+                R = (px[0] + px[3] + 1) >> 1;
+                G = (px[1] + px[4] + 1) >> 1;
+                B = (px[2] + px[5] + 1) >> 1;
+            }
+
+            const uint8_t U = yuv_u(R, G, B), V = yuv_v(R, G, B);
+
+            if (layout == yuv_layout::yuyv)
+            {
+                uint8_t* dest = buf + y * stride + c * 4;
+                dest[0] = yuv_y(px[0], px[1], px[2]);
+                dest[1] = U;
+                dest[2] = yuv_y(px[3], px[4], px[5]);
+                dest[3] = V;
+                continue;
+            }
+
+            uint8_t* chroma = buf + stride * H;
+            if (layout == yuv_layout::nv12)
+            {
+                chroma[y / 2 * stride + c * 2 + 0] = U;
+                chroma[y / 2 * stride + c * 2 + 1] = V;
+            }
+            else
+            {
+                chroma[y / 2 * (stride / 2) + c] = U;
+                chroma[(stride / 2) * (H / 2) + y / 2 * (stride / 2) + c] = V;
+            }
+        }
+
+        if (subsampled)
+            for (int k = 0; k < rows; k++)
+                for (int x = 0; x < W; x++)
+                {
+                    const uint8_t* px = &rgb[unsigned((k * W + x) * 3)];
+                    buf[(y + k) * stride + x] = yuv_y(px[0], px[1], px[2]);
+                }
+    }
+}
+
+// Channels 0 and 2 are B and R for in_BGR, otherwise R and B. One channel
+// is gray.
+template<int num_output_channels, bool in_BGR = true>
+static void debayer_binned(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                           int stride, int y0, int y1)
+{
+    (void)H;
+
+    for (int y = y0; y < y1; y++)
+    {
+        // G R
+        // B G
+        const uint8_t* top = input + 2 * y * W;
+        const uint8_t* bottom = top + W;
+        uint8_t* dest = buf + y * stride;
+
+        for (int x = 0; x < W / 2; x++, top += 2, bottom += 2, dest += num_output_channels)
+        {
+            unsigned R = top[1], B = bottom[0];
+            unsigned G = (top[0] + bottom[1] + 1) >> 1;
+
+            if (num_output_channels == 1)
+                dest[0] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+            else
+            {
+                dest[0] = (uint8_t)(in_BGR ? B : R);
+                dest[1] = (uint8_t)G;
+                dest[2] = (uint8_t)(in_BGR ? R : B);
+                if (num_output_channels == 4)
+                    dest[3] = 0xff;
+            }
+        }
+    }
+}
+
+// See debayer_impl::malvar. Channels 0 and 2 are B and R for in_BGR,
+// otherwise R and B.
+template<int num_output_channels, bool in_BGR = true>
+static void debayer_malvar(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                           int stride, int y0, int y1)
+{
+    auto mirror = [](int i, int n) { return i < 0 ? -i : i >= n ? 2 * (n - 1) - i : i; };
+    auto fixed = [](int sum) { return std::clamp((sum + 8) >> 4, 0, 255); };
+
+    for (int y = y0; y < y1; y++)
+    {
+        const uint8_t* rows[5];
+        for (int k = 0; k < 5; k++)
+            rows[k] = input + mirror(y + k - 2, H) * W;
+        uint8_t* dest = buf + y * stride;
+
+        for (int x = 1; x < W - 1; x++)
+        {
+            // the sample dx to the right of and dy below the center
+            auto p = [&](int dx, int dy) { return (int)rows[dy + 2][mirror(x + dx, W)]; };
+
+            int center = p(0, 0);
+            int h1 = p(-1, 0) + p(1, 0), v1 = p(0, -1) + p(0, 1);
+            int h2 = p(-2, 0) + p(2, 0), v2 = p(0, -2) + p(0, 2);
+            int diag = p(-1, -1) + p(1, -1) + p(-1, 1) + p(1, 1);
+
+            // G at R or B; R or B at G, where it's the horizontal or the
+            // vertical neighbor; B at R or R at B
+            int cross = fixed(8 * center + 4 * (h1 + v1) - 2 * (h2 + v2));
+            int horiz = fixed(10 * center + 8 * h1 - 2 * h2 - 2 * diag + v2);
+            int vert = fixed(10 * center + 8 * v1 - 2 * v2 - 2 * diag + h2);
+            int opposite = fixed(12 * center + 4 * diag - 3 * (h2 + v2));
+
+            int R, G, B;
+            if (y % 2 == 0)
+            {
+                if (x % 2 == 0)
+                    R = horiz, G = center, B = vert;
+                else
+                    R = center, G = cross, B = opposite;
+            }
+            else
+            {
+                if (x % 2 == 0)
+                    R = opposite, G = cross, B = center;
+                else
+                    R = vert, G = center, B = horiz;
+            }
+
+            uint8_t* px = dest + x * num_output_channels;
+            px[0] = (uint8_t)(in_BGR ? B : R);
+            px[1] = (uint8_t)G;
+            px[2] = (uint8_t)(in_BGR ? R : B);
+            if (num_output_channels == 4)
+                px[3] = 0xff;
+        }
+
+        for (int c = 0; c < num_output_channels; c++)
+        {
+            dest[c] = dest[num_output_channels + c];
+            dest[(W - 1) * num_output_channels + c] = dest[(W - 2) * num_output_channels + c];
+        }
+    }
+
+    // Fill first & last row, if they're next to this band
+    for (int i = 0; i < W * num_output_channels; i++)
+    {
+        if (y0 == 1)
+            buf[i] = buf[i + stride];
+        if (y1 == H - 1)
+            buf[i + (H - 1) * stride] = buf[i + (H - 2) * stride];
+    }
+}
+
+const debayer_impl& debayer_scalar()
+{
+    static const debayer_impl impl = {
+        "scalar", debayer_gray, debayer_rgb<true>, debayer_rgb<false>,
+        debayer_rgb<true, 4>, debayer_rgb<false, 4>,
+        debayer_yuv<yuv_layout::nv12>, debayer_yuv<yuv_layout::i420>, debayer_yuv<yuv_layout::yuyv>,
+        { debayer_binned<1>, debayer_binned<3, true>, debayer_binned<3, false>,
+          debayer_binned<4, true>, debayer_binned<4, false> },
+        { debayer_malvar<3, true>, debayer_malvar<3, false>, debayer_malvar<4, true>, debayer_malvar<4, false> },
+    };
+    return impl;
+}
+
+#if defined __i386__ || defined __x86_64__ || defined _M_IX86 || defined _M_X64
+static bool cpu_has_sse2()
+{
+#if defined __x86_64__ || defined _M_X64
+    return true;
+#elif defined _MSC_VER
+    int regs[4];
+    __cpuid(regs, 1);
+    return regs[3] & (1 << 26);
+#else
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return false;
+    __cpuid(regs, 1);
+    // the OS has to save the ymm registers on context switch as well
+    constexpr int osxsave_avx = 1 << 27 | 1 << 28;
+    if ((regs[2] & osxsave_avx) != osxsave_avx || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(regs, 7, 0);
+    return regs[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+std::vector<const debayer_impl*> debayer_impls()
+{
+    std::vector<const debayer_impl*> ret { &debayer_scalar() };
+
+#if defined __i386__ || defined __x86_64__ || defined _M_IX86 || defined _M_X64
+    if (debayer_sse2() && cpu_has_sse2())
+        ret.push_back(debayer_sse2());
+    if (debayer_avx2() && cpu_has_avx2())
+        ret.push_back(debayer_avx2());
+#endif
+    // NEON is only compiled in when the target guarantees it.
+    if (debayer_neon())
+        ret.push_back(debayer_neon());
+
+    return ret;
+}
+
+const debayer_impl& debayer_best()
+{
+    static const debayer_impl& impl = *debayer_impls().back();
+    return impl;
+}
+
+} // ns ps3eye::detail
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace ps3eye::detail {
+
+// Converts output rows [y0, y1) of a W x H frame, where 1 <= y0 < y1 <= H-1.
+// The first and last rows are copies of their neighbors; they get written
+// by the band that has y0 == 1 or y1 == H-1 respectively. Bands don't
+// write outside their rows, so disjoint ones can run concurrently.
+// Output rows are `stride` bytes apart, at least W times the pixel size;
+// the padding after each row is left alone.
+using debayer_fn = void(*)(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf,
+                           int stride, int y0, int y1);
+
+// BT.601 studio range YUV, for even W. Y is (66R + 129G + 25B + 128) >> 8
+// plus 16; U and V likewise from the RGB of the 2x1 (YUYV) or 2x2 (NV12,
+// I420) block they cover, averaged first with rounding:
+//
+// - nv12: W x H luma plane, then W/2 x H/2 interleaved U/V pairs, both
+//   with rows `stride` bytes apart,
+// - i420: W x H luma plane, then W/2 x H/2 U plane and V plane with rows
+//   stride/2 bytes apart,
+// - yuyv: W x H pairs of pixels as Y0 U Y1 V.
+//
+// For the 4:2:0 layouts bands have to hold whole row pairs: y0 is 1 or
+// even, y1 is even or H-1, and H is even.
+enum class yuv_layout { nv12, i420, yuyv };
+
+// A set of Bayer (GRBG) to output format conversions. Every
+// implementation must produce output bit-identical to the scalar one.
+struct debayer_impl final
+{
+    const char* name;
+    debayer_fn gray;
+    debayer_fn bgr;
+    debayer_fn rgb;
+    // as bgr and rgb with a fourth byte of 0xff
+    debayer_fn bgra;
+    debayer_fn rgba;
+    debayer_fn nv12;
+    debayer_fn i420;
+    debayer_fn yuyv;
+
+    // 2x2 binning, for even W and H: each GRBG quad becomes one pixel of
+    // its R, its B and the rounded average of its two G, and the output
+    // is W/2 x H/2. These convert output rows [y0, y1) for any
+    // 0 <= y0 < y1 <= H/2; there are no edges to copy.
+    struct
+    {
+        debayer_fn gray;
+        debayer_fn bgr;
+        debayer_fn rgb;
+        debayer_fn bgra;
+        debayer_fn rgba;
+    } binned;
+
+    // Malvar-He-Cutler gradient-corrected interpolation: the bilinear
+    // estimate of a missing color plus a correction from the gradient of
+    // the color that was sampled, over a 5x5 window. Fixed point with
+    // weights in sixteenths, rounded, clamped to 0-255. Rows and columns
+    // beyond the frame mirror the ones inside it, -1 being 1 and W being
+    // W-2, which keeps the Bayer phase. Bands and edges as above.
+    struct
+    {
+        debayer_fn bgr;
+        debayer_fn rgb;
+        debayer_fn bgra;
+        debayer_fn rgba;
+    } malvar;
+};
+
+// The scalar reference, always available.
+const debayer_impl& debayer_scalar();
+
+// Vectorized kernels. These return nullptr when the kernel wasn't
+// compiled in. They don't check for CPU support.
+const debayer_impl* debayer_sse2();
+const debayer_impl* debayer_avx2();
+const debayer_impl* debayer_neon();
+
+// Kernels the CPU can run, scalar first and fastest last.
+std::vector<const debayer_impl*> debayer_impls();
+
+// Fastest kernel for the CPU, picked once on first use.
+const debayer_impl& debayer_best();
+
+} // ns ps3eye::detail
@@ -0,0 +1,149 @@
+#include "delivery.hpp"
+
+#include <algorithm>
+
+namespace ps3eye::detail {
+
+delivery_pool::delivery_pool()
+{
+    set_threads(0);
+}
+
+delivery_pool::~delivery_pool()
+{
+    stop_workers();
+}
+
+delivery_pool& delivery_pool::instance()
+{
+    static delivery_pool ret;
+    return ret;
+}
+
+void delivery_pool::set_threads(unsigned n)
+{
+    if (n == 0)
+        n = std::clamp(std::thread::hardware_concurrency(), 1u, 4u);
+    n = std::min(n, max_threads);
+
+    std::lock_guard<std::mutex> lock(threads_mutex_);
+    if (n == workers_.size())
+        return;
+
+    // Queued tasks stay queued for the new workers.
+    stop_workers();
+
+    workers_.reserve(n);
+    for (unsigned i = 0; i < n; i++)
+        workers_.emplace_back(&delivery_pool::worker, this);
+}
+
+unsigned delivery_pool::threads()
+{
+    std::lock_guard<std::mutex> lock(threads_mutex_);
+    return unsigned(workers_.size());
+}
+
+void delivery_pool::stop_workers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        exit_ = true;
+    }
+    wake_.notify_all();
+
+    for (std::thread& t : workers_)
+        t.join();
+    workers_.clear();
+
+    exit_ = false;
+}
+
+void delivery_pool::push(delivery_task& task)
+{
+    task.queued_ = true;
+    task.next_ = nullptr;
+    if (tail_)
+        tail_->next_ = &task;
+    else
+        head_ = &task;
+    tail_ = &task;
+}
+
+void delivery_pool::post(delivery_task& task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (task.queued_)
+            return;
+        if (task.running_)
+        {
+            // The worker running it requeues it when done.
+            task.again_ = true;
+            return;
+        }
+        push(task);
+    }
+    wake_.notify_one();
+}
+
+void delivery_pool::cancel(delivery_task& task)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (task.queued_)
+    {
+        delivery_task** link = &head_;
+        delivery_task* prev = nullptr;
+        while (*link != &task)
+        {
+            prev = *link;
+            link = &(*link)->next_;
+        }
+        *link = task.next_;
+        if (tail_ == &task)
+            tail_ = prev;
+        task.queued_ = false;
+    }
+    task.again_ = false;
+
+    if (task.running_ && task.runner_ != std::this_thread::get_id())
+        idle_.wait(lock, [&] { return !task.running_; });
+    // Don't let the run in progress requeue it either.
+    task.again_ = false;
+}
+
+void delivery_pool::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    for (;;)
+    {
+        wake_.wait(lock, [this] { return exit_ || head_; });
+        if (exit_)
+            return;
+
+        delivery_task& task = *head_;
+        head_ = task.next_;
+        if (!head_)
+            tail_ = nullptr;
+        task.queued_ = false;
+        task.running_ = true;
+        task.runner_ = std::this_thread::get_id();
+        lock.unlock();
+
+        task.fn_(task.data_);
+
+        lock.lock();
+        task.running_ = false;
+        task.runner_ = {};
+        if (task.again_)
+        {
+            task.again_ = false;
+            push(task);
+        }
+        idle_.notify_all();
+    }
+}
+
+} // ns ps3eye::detail
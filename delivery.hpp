@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ps3eye::detail {
+
+// Something for a delivery_pool thread to do, posted again whenever there
+// is more. The pool never runs the same task on two threads at once, and
+// a task posted while it runs is run once more afterwards.
+struct delivery_task final
+{
+    using task_fn = void(*)(void* data);
+
+    delivery_task(task_fn fn, void* data) : fn_(fn), data_(data) {}
+
+    delivery_task(const delivery_task&) = delete;
+    void operator=(const delivery_task&) = delete;
+
+private:
+    friend struct delivery_pool;
+
+    task_fn fn_;
+    void* data_;
+    delivery_task* next_ = nullptr;
+    std::thread::id runner_;
+    bool queued_ = false;
+    bool running_ = false;
+    bool again_ = false;
+};
+
+// Threads shared by all cameras that push frames to a callback, so that a
+// rig needn't block one thread per camera in get_frame(). Tasks run in
+// the order posted.
+struct delivery_pool final
+{
+    static constexpr unsigned max_threads = 64;
+
+    static delivery_pool& instance();
+
+    ~delivery_pool();
+
+    // 1 to max_threads. 0 picks the default, the number of cores up to 4.
+    void set_threads(unsigned n);
+    unsigned threads();
+
+    // Cheap enough for the USB thread; doesn't allocate.
+    void post(delivery_task& task);
+    // Take the task off the queue and wait for it to finish running,
+    // unless that's on this very thread.
+    void cancel(delivery_task& task);
+
+    delivery_pool(const delivery_pool&) = delete;
+    void operator=(const delivery_pool&) = delete;
+
+private:
+    delivery_pool();
+
+    void worker();
+    void stop_workers();
+    void push(delivery_task& task);
+
+    // Guards the workers against concurrent set_threads()
+    std::mutex threads_mutex_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_, idle_;
+
+    delivery_task* head_ = nullptr;
+    delivery_task* tail_ = nullptr;
+    bool exit_ = false;
+};
+
+} // ns ps3eye::detail
@@ -0,0 +1,73 @@
+#include "futex.hpp"
+
+#if defined __linux__
+#   include <linux/futex.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#   include <ctime>
+#elif defined _WIN32
+#   include <windows.h>
+#else
+#   include <mutex>
+#   include <condition_variable>
+#endif
+
+namespace ps3eye::detail {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+
+#if defined __linux__
+
+void futex_wait(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::microseconds timeout)
+{
+    using namespace std::chrono;
+
+    struct timespec ts;
+    ts.tv_sec = (time_t)duration_cast<seconds>(timeout).count();
+    ts.tv_nsec = (long)duration_cast<nanoseconds>(timeout % seconds(1)).count();
+
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+}
+
+void futex_wake_all(std::atomic<uint32_t>& word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+#elif defined _WIN32
+
+void futex_wait(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::microseconds timeout)
+{
+    using namespace std::chrono;
+    DWORD ms = (DWORD)ceil<milliseconds>(timeout).count();
+    WaitOnAddress(reinterpret_cast<volatile uint32_t*>(&word), &expected, sizeof(expected), ms);
+}
+
+void futex_wake_all(std::atomic<uint32_t>& word)
+{
+    WakeByAddressAll(reinterpret_cast<uint32_t*>(&word));
+}
+
+#else
+
+// No address-based wait here; fall back to a condition variable shared by
+// all words. The waker only takes the mutex briefly.
+
+static std::mutex futex_mutex;
+static std::condition_variable futex_cv;
+
+void futex_wait(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::microseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(futex_mutex);
+    futex_cv.wait_for(lock, timeout, [&] { return word.load() != expected; });
+}
+
+void futex_wake_all(std::atomic<uint32_t>&)
+{
+    { std::lock_guard<std::mutex> lock(futex_mutex); }
+    futex_cv.notify_all();
+}
+
+#endif
+
+} // ns ps3eye::detail
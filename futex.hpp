@@ -0,0 +1,16 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace ps3eye::detail {
+
+// Block while `word` still holds `expected`, for at most `timeout`. May
+// return early or spuriously, callers have to recheck their condition.
+void futex_wait(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::microseconds timeout);
+
+// Wake up every thread blocked in futex_wait() on `word`.
+void futex_wake_all(std::atomic<uint32_t>& word);
+
+} // ns ps3eye::detail
@@ -0,0 +1,159 @@
+#include "group.hpp"
+#include "internal.hpp"
+
+#include <algorithm>
+#include <climits>
+
+using ps3eye::detail::ps3eye_debug;
+
+namespace ps3eye {
+
+camera_group::camera_group(std::vector<std::shared_ptr<camera>> cameras) :
+    cameras_(std::move(cameras)), leases_(cameras_.size())
+{
+}
+
+camera_group::~camera_group()
+{
+    stop();
+}
+
+bool camera_group::start()
+{
+    using namespace std::chrono;
+
+    if (!tolerance_set_)
+    {
+        int fps = INT_MAX;
+        for (const auto& cam : cameras_)
+            fps = std::min(fps, cam->framerate());
+        tolerance_ = fps > 0 && fps != INT_MAX
+                     ? duration_cast<microseconds>(seconds(1)) / (2 * fps)
+                     : microseconds(0);
+    }
+
+    // Start them back to back so that their first frames are as close as
+    // the sensors allow.
+    for (const auto& cam : cameras_)
+        if (!cam->start())
+        {
+            ps3eye_debug("camera group: can't start camera\n");
+            stop();
+            return false;
+        }
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_ = {};
+        skew_sum_us_ = 0;
+    }
+
+    return true;
+}
+
+void camera_group::stop()
+{
+    for (frame_lease& lease : leases_)
+        lease.release();
+    for (const auto& cam : cameras_)
+        cam->stop();
+}
+
+void camera_group::set_tolerance(std::chrono::microseconds value)
+{
+    tolerance_ = value;
+    tolerance_set_ = true;
+}
+
+bool camera_group::get_frames(uint8_t* const* frames, frame_metadata* meta, std::chrono::milliseconds timeout)
+{
+    using namespace std::chrono;
+    using clock = steady_clock;
+
+    if (cameras_.empty())
+        return false;
+
+    const auto deadline = clock::now() + timeout;
+    const unsigned n = (unsigned)cameras_.size();
+
+    for (;;)
+    {
+        // Fill in the cameras we don't hold a frame for. acquire_frame()
+        // waits a bit for each, so check the deadline in between.
+        bool complete = true;
+        for (unsigned i = 0; i < n; i++)
+            if (!leases_[i])
+            {
+                leases_[i] = cameras_[i]->acquire_frame();
+                complete &= !!leases_[i];
+            }
+
+        if (!complete)
+        {
+            if (clock::now() >= deadline)
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                stats_.timeouts++;
+                return false;
+            }
+            continue;
+        }
+
+        auto [ oldest, newest ] = std::minmax_element(leases_.begin(), leases_.end(),
+            [](const frame_lease& a, const frame_lease& b) {
+                return a.metadata().first_payload < b.metadata().first_payload;
+            });
+        const clock::time_point latest = newest->metadata().first_payload;
+        const auto skew = duration_cast<microseconds>(latest - oldest->metadata().first_payload);
+
+        if (skew <= tolerance_)
+        {
+            for (unsigned i = 0; i < n; i++)
+            {
+                cameras_[i]->convert_frame(leases_[i], frames[i]);
+                if (meta)
+                    meta[i] = leases_[i].metadata();
+                leases_[i].release();
+            }
+
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.sets_delivered++;
+            stats_.last_skew = skew;
+            stats_.max_skew = std::max(stats_.max_skew, skew);
+            skew_sum_us_ += (uint64_t)skew.count();
+            stats_.mean_skew = microseconds(skew_sum_us_ / stats_.sets_delivered);
+
+            return true;
+        }
+
+        // Frames too old to match the newest one can't be part of any
+        // set anymore, drop them and wait for their successors.
+        unsigned dropped = 0;
+        for (frame_lease& lease : leases_)
+            if (latest - lease.metadata().first_payload > tolerance_)
+            {
+                lease.release();
+                dropped++;
+            }
+
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.frames_unmatched += dropped;
+        }
+
+        if (clock::now() >= deadline)
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.timeouts++;
+            return false;
+        }
+    }
+}
+
+group_stats camera_group::stats() const
+{
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+} // ns ps3eye
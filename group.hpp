@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ps3eye.hpp"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace ps3eye {
+
+struct group_stats
+{
+    uint64_t sets_delivered = 0;
+    uint64_t frames_unmatched = 0;  // skipped because no partner frames came
+    uint64_t timeouts = 0;
+
+    // Spread between the earliest and latest frame of delivered sets
+    std::chrono::microseconds last_skew {};
+    std::chrono::microseconds max_skew {};
+    std::chrono::microseconds mean_skew {};
+};
+
+// Several cameras started together whose frames are handed out in matched
+// sets, one frame per camera, aligned by host timestamp. The cameras have
+// to be init()'ed already; each keeps its own format and settings. The
+// bridges' PTS clocks aren't related to each other, so matching uses the
+// host time of each frame's first payload.
+struct camera_group final
+{
+    explicit camera_group(std::vector<std::shared_ptr<camera>> cameras);
+    ~camera_group();
+
+    [[nodiscard]] bool start();
+    void stop();
+
+    // Largest spread of timestamps within a set. Defaults to half the frame
+    // period of the slowest camera.
+    void set_tolerance(std::chrono::microseconds value);
+    std::chrono::microseconds tolerance() const { return tolerance_; }
+
+    // Block until every camera has a frame within the tolerance of the
+    // others. frames[i] receives the frame of camera i, sized as for
+    // camera::get_frame(). meta, if given, gets one entry per camera.
+    [[nodiscard]] bool get_frames(uint8_t* const* frames, frame_metadata* meta = nullptr,
+                                  std::chrono::milliseconds timeout = std::chrono::milliseconds(500));
+
+    group_stats stats() const;
+
+    const std::vector<std::shared_ptr<camera>>& cameras() const { return cameras_; }
+
+    camera_group(const camera_group&) = delete;
+    void operator=(const camera_group&) = delete;
+
+private:
+    std::vector<std::shared_ptr<camera>> cameras_;
+    std::vector<frame_lease> leases_;
+    std::chrono::microseconds tolerance_ {};
+    bool tolerance_set_ = false;
+
+    mutable std::mutex stats_mutex_;
+    group_stats stats_;
+    uint64_t skew_sum_us_ = 0;
+};
+
+} // ns ps3eye
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
 #ifdef PS3EYE_DEBUG
 #   include <cstdio>
 #endif
@@ -42,6 +46,164 @@ enum class format
     Bayer, // Output in Bayer. Destination buffer must be width * height bytes
     BGR, // Output in BGR. Destination buffer must be width * height * 3 bytes
     RGB, // Output in RGB. Destination buffer must be width * height * 3 bytes
-    Gray // Output in Grayscale. Destination buffer must be width * height bytes
+    Gray, // Output in Grayscale. Destination buffer must be width * height bytes
+    NV12, // Output in BT.601 YUV 4:2:0, Y plane then interleaved U/V. Destination buffer must be width * height * 3 / 2 bytes
+    I420, // Output in BT.601 YUV 4:2:0, Y plane then U and V planes. Destination buffer must be width * height * 3 / 2 bytes
+    YUYV, // Output in BT.601 YUV 4:2:2, packed Y0 U Y1 V. Destination buffer must be width * height * 2 bytes
+    BGRA, // Output in BGR with alpha 0xff. Destination buffer must be width * height * 4 bytes
+    RGBA, // Output in RGB with alpha 0xff. Destination buffer must be width * height * 4 bytes
+};
+
+// The sizes above are for the default stride, see camera::set_stride().
+
+// Output size relative to the sensor's, see camera::init().
+enum class output_scale : uint8_t
+{
+    full,
+    half, // 2x2 binning: each Bayer quad becomes a pixel. BGR, RGB, BGRA, RGBA and Gray only
+};
+
+// How the missing colors of each pixel are interpolated, see
+// camera::set_demosaic().
+enum class demosaic : uint8_t
+{
+    bilinear, // average of the nearest samples of each color
+    malvar, // Malvar-He-Cutler: bilinear plus a 5x5 gradient correction. Less fringing at edges. BGR, RGB, BGRA and RGBA only
+};
+
+// What to do with a new frame when the consumer has all but one of the
+// queued frames still to read, see camera::set_frame_drop_policy().
+enum class drop_policy : uint8_t
+{
+    drop_newest, // overwrite the newest frame, the consumer sees a gap
+    drop_oldest, // discard the oldest unread frame, the rest stay in order
+    latest_only, // as drop_oldest, and get_frame() skips to the newest frame
+    never_drop, // make the USB thread wait for the consumer, up to 500 ms
+};
+
+// The settings camera::set_control_async() can change, with the values
+// of their set_*() functions. flip is 1 for horizontal plus 2 for vertical.
+enum class control : uint8_t
+{
+    auto_gain,
+    awb,
+    gain,
+    exposure,
+    sharpness,
+    contrast,
+    brightness,
+    hue,
+    red_balance,
+    blue_balance,
+    green_balance,
+    saturation,
+    flip,
+    test_pattern,
+};
+
+// Outcome of camera::get_frame() with a timeout.
+enum class frame_status : uint8_t
+{
+    ok,
+    timeout, // no frame arrived in time
+    busy, // a frame_lease is still held, or frames go to a callback
+    not_streaming, // start() wasn't called, or stop() was
+    error, // a USB error stopped the camera
+};
+
+// How the libusb event handling, and with it parsing and queueing of
+// frames, is spread over threads, see camera::set_event_threads().
+enum class event_model : uint8_t
+{
+    shared, // one thread for all cameras
+    pooled, // a fixed number of threads, cameras assigned in turn
+    per_camera, // a thread for each open camera
+};
+
+struct event_thread_config
+{
+    event_model model = event_model::shared;
+    // Number of threads for event_model::pooled.
+    unsigned threads = 2;
+    // Pin the threads to these CPUs, in turn. Empty leaves them be.
+    std::vector<int> cpus;
+    // SCHED_FIFO priority, 1 to 99, where the process may use it; the
+    // highest priority class on Windows. 0 keeps the default.
+    int realtime_priority = 0;
+};
+
+// Where the time went in the last camera::init() and start(), and how
+// much it took to program the camera.
+struct startup_timing
+{
+    using duration = std::chrono::microseconds;
+
+    duration open {};           // opening and claiming the device
+    duration reset {};          // bridge and sensor reset, with settling
+    duration bridge_init {};
+    duration sensor_init {};
+    duration start_registers {}; // resolution and frame rate
+    duration controls {};       // the twelve controls and the LED
+    duration stream {};         // allocating and submitting transfers
+
+    unsigned control_writes = 0;
+    unsigned control_reads = 0;
+    unsigned sensor_writes_skipped = 0; // sensor held the value already
+};
+
+// Pacing of a replayed capture, see open_replay().
+enum class replay_rate
+{
+    recorded, // with the original spacing between transfers
+    max, // no pacing; frames the consumer misses are overwritten as usual
+};
+
+// A rectangle of the output frame, in pixels.
+struct frame_roi
+{
+    int x = 0, y = 0;
+    int width = 0, height = 0;
+};
+
+struct frame_metadata
+{
+    // Counts completed frames since start(). Gaps mean dropped frames.
+    uint64_t sequence = 0;
+    // Host time when the transfer holding the last payload completed,
+    // i.e. when the frame was complete
+    std::chrono::steady_clock::time_point timestamp;
+    // Same for the first payload, roughly when the sensor began readout
+    std::chrono::steady_clock::time_point first_payload;
+    // Presentation timestamp from the UVC payload headers, in bridge
+    // clock ticks. Wraps around.
+    uint32_t pts = 0;
+};
+
+// Counters since the last start(), see camera::stats().
+struct capture_stats
+{
+    uint64_t bytes_received = 0;
+    uint64_t transfers_completed = 0;
+    uint64_t transfer_errors = 0;       // transfers failed or not resubmitted
+    uint64_t transfers_unrecorded = 0;  // missing from the capture file
+
+    uint64_t payloads_bad_header = 0;
+    uint64_t payloads_error = 0;        // UVC error bit set
+    uint64_t payloads_no_pts = 0;
+
+    uint64_t frames_completed = 0;      // passed to the frame queue
+    uint64_t frames_incomplete = 0;     // abandoned while being received
+    uint64_t frames_overwritten = 0;    // newest replaced, queue full
+    uint64_t frames_evicted = 0;        // oldest discarded, queue full
+    uint64_t frames_skipped = 0;        // passed over for a newer one
+    uint64_t frames_delivered = 0;      // by get_frame() or acquire_frame()
+    uint64_t frames_dropped = 0;        // all of the above but delivered
+    uint64_t producer_stalls = 0;       // USB thread had to wait (never_drop)
+
+    uint64_t get_frame_timeouts = 0;
+
+    drop_policy policy = drop_policy::drop_newest;  // that the counts are for
+    uint32_t transfer_count = 0;        // bulk transfers kept in flight
+    uint32_t transfer_size = 0;         // bytes each; both 0 for replays
 };
 } // ns ps3eye
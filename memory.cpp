@@ -0,0 +1,121 @@
+#include "memory.hpp"
+#include "internal.hpp"
+
+#if defined __linux__
+#   include <sys/mman.h>
+#elif defined _WIN32
+#   include <windows.h>
+#else
+#   include <new>
+#endif
+
+namespace ps3eye::detail {
+
+page_buffer::~page_buffer()
+{
+    free();
+}
+
+#if defined __linux__
+
+bool page_buffer::allocate(size_t size)
+{
+    constexpr size_t huge_page = 2 << 20;
+    free();
+
+    // Explicit huge pages need a reserved pool, transparent ones only a
+    // hint. Smaller buffers would waste most of a huge page.
+    if (size >= huge_page)
+    {
+        size_t len = (size + huge_page - 1) & ~(huge_page - 1);
+        void* ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED)
+        {
+            data_ = (uint8_t*)ptr;
+            size_ = size;
+            mapped_ = len;
+            return true;
+        }
+    }
+
+    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+    {
+        ps3eye_debug("can't allocate %u bytes for frames\n", (unsigned)size);
+        return false;
+    }
+#ifdef MADV_HUGEPAGE
+    if (size >= huge_page)
+        (void)madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+
+    data_ = (uint8_t*)ptr;
+    size_ = mapped_ = size;
+    return true;
+}
+
+void page_buffer::free()
+{
+    if (data_)
+        munmap(data_, mapped_);
+    data_ = nullptr;
+    size_ = mapped_ = 0;
+}
+
+#elif defined _WIN32
+
+// Large pages need SeLockMemoryPrivilege, which normal users don't have.
+bool page_buffer::allocate(size_t size)
+{
+    free();
+
+    void* ptr = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!ptr)
+    {
+        ps3eye_debug("can't allocate %u bytes for frames\n", (unsigned)size);
+        return false;
+    }
+
+    data_ = (uint8_t*)ptr;
+    size_ = mapped_ = size;
+    return true;
+}
+
+void page_buffer::free()
+{
+    if (data_)
+        VirtualFree(data_, 0, MEM_RELEASE);
+    data_ = nullptr;
+    size_ = mapped_ = 0;
+}
+
+#else
+
+static constexpr std::align_val_t page_alignment { 4096 };
+
+bool page_buffer::allocate(size_t size)
+{
+    free();
+
+    data_ = (uint8_t*)::operator new(size, page_alignment, std::nothrow);
+    if (!data_)
+    {
+        ps3eye_debug("can't allocate %u bytes for frames\n", (unsigned)size);
+        return false;
+    }
+
+    size_ = mapped_ = size;
+    return true;
+}
+
+void page_buffer::free()
+{
+    if (data_)
+        ::operator delete(data_, page_alignment);
+    data_ = nullptr;
+    size_ = mapped_ = 0;
+}
+
+#endif
+
+} // ns ps3eye::detail
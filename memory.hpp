@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ps3eye::detail {
+
+// Page-aligned memory for a frame ring. Buffers spanning at least a huge
+// page are backed by huge pages where the OS provides them, so that
+// walking a frame doesn't thrash the TLB.
+struct page_buffer final
+{
+    page_buffer() = default;
+    ~page_buffer();
+
+    [[nodiscard]] bool allocate(size_t size);
+    void free();
+
+    uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    page_buffer(const page_buffer&) = delete;
+    void operator=(const page_buffer&) = delete;
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    size_t mapped_ = 0;
+};
+
+} // ns ps3eye::detail
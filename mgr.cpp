@@ -5,8 +5,18 @@
 #include "internal.hpp"
 #include "ps3eye.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 #include <libusb.h>
 
+#if defined __linux__ || defined __APPLE__ || defined __unix__
+#   include <pthread.h>
+#   include <sched.h>
+#elif defined _WIN32
+#   include <windows.h>
+#endif
+
 namespace ps3eye::detail {
 
 extern volatile bool _ps3eye_debug_status;
@@ -16,48 +26,106 @@ enum {
     product_id = 0x2000,
 };
 
-usb_manager::usb_manager()
+static void set_log_level(libusb_context* context, bool debug)
 {
-    libusb_init(&usb_context);
-    libusb_set_option(usb_context,
+    libusb_set_option(context,
                       LIBUSB_OPTION_LOG_LEVEL,
-                      _ps3eye_debug_status ? LIBUSB_LOG_LEVEL_INFO : LIBUSB_LOG_LEVEL_NONE);
+                      debug ? LIBUSB_LOG_LEVEL_INFO : LIBUSB_LOG_LEVEL_NONE);
 }
 
-usb_manager::~usb_manager()
+// Pinning and priority are best effort; both commonly need privileges.
+static void configure_thread(int cpu, int priority)
+{
+#if defined __linux__
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            ps3eye_debug("can't pin event thread to cpu %d: %s\n", cpu, strerror(err));
+    }
+#elif defined _WIN32
+    if (cpu >= 0 && !SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu))
+        ps3eye_debug("can't pin event thread to cpu %d\n", cpu);
+#else
+    (void)cpu;
+#endif
+
+    if (priority <= 0)
+        return;
+#if defined _WIN32
+    if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+        ps3eye_debug("can't raise event thread priority\n");
+#else
+    sched_param param {};
+    param.sched_priority = priority;
+    if (int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param))
+        ps3eye_debug("can't set SCHED_FIFO priority %d: %s\n", priority, strerror(err));
+#endif
+}
+
+event_loop::event_loop(libusb_context* context, bool owns_context, int cpu, int priority) :
+    context_(context), owns_context_(owns_context), cpu_(cpu), priority_(priority)
+{
+}
+
+event_loop::~event_loop()
 {
-    //ps3eye_debug("usb_manager destructor\n");
     if (update_thread.joinable())
         stop_xfer_thread();
-    libusb_exit(usb_context);
+    if (owns_context_)
+        libusb_exit(context_);
 }
 
-usb_manager& usb_manager::instance()
+libusb_device* event_loop::find(libusb_device* device) const
 {
-    static usb_manager ret;
+    if (!owns_context_)
+        return libusb_ref_device(device);
+
+    // Bus and port path stay the same across contexts, unlike addresses
+    // of reconnected devices.
+    uint8_t path[8], other_path[8];
+    const int len = libusb_get_port_numbers(device, path, sizeof(path));
+    const uint8_t bus = libusb_get_bus_number(device);
+
+    libusb_device** devs;
+    ssize_t cnt = libusb_get_device_list(context_, &devs);
+    if (cnt < 0)
+        return nullptr;
+
+    libusb_device* ret = nullptr;
+    for (ssize_t i = 0; i < cnt && !ret; i++)
+    {
+        if (libusb_get_bus_number(devs[i]) != bus)
+            continue;
+        int n = libusb_get_port_numbers(devs[i], other_path, sizeof(other_path));
+        if (n == len && n >= 0 && !memcmp(path, other_path, (size_t)n))
+            ret = libusb_ref_device(devs[i]);
+    }
+    libusb_free_device_list(devs, 1);
+
     return ret;
 }
 
-void usb_manager::camera_started()
+void event_loop::camera_started()
 {
-    assert(usb_context);
-
     if (active_camera_count.fetch_add(1, std::memory_order_relaxed) == 0)
         start_xfer_thread();
 }
 
-void usb_manager::camera_stopped()
+void event_loop::camera_stopped()
 {
     if (active_camera_count.fetch_sub(1, std::memory_order_relaxed) == 1)
         stop_xfer_thread();
 }
 
-void usb_manager::start_xfer_thread()
+void event_loop::start_xfer_thread()
 {
-    update_thread = std::thread(&usb_manager::xfer_callback, this);
+    update_thread = std::thread(&event_loop::xfer_callback, this);
 }
 
-void usb_manager::stop_xfer_thread()
+void event_loop::stop_xfer_thread()
 {
     exit_signaled = true;
     update_thread.join();
@@ -67,12 +135,112 @@ void usb_manager::stop_xfer_thread()
     exit_signaled = false;
 }
 
-void usb_manager::xfer_callback()
+void event_loop::xfer_callback()
 {
     struct timeval tv { 0, 100 * 1000 /* ms */ };
 
+    configure_thread(cpu_, priority_);
+
     while (!(exit_signaled.load(std::memory_order_relaxed)))
-        libusb_handle_events_timeout_completed(usb_context, &tv, nullptr);
+        libusb_handle_events_timeout_completed(context_, &tv, nullptr);
+}
+
+usb_manager::usb_manager()
+{
+    libusb_init(&usb_context);
+    set_log_level(usb_context, _ps3eye_debug_status);
+}
+
+usb_manager::~usb_manager()
+{
+    //ps3eye_debug("usb_manager destructor\n");
+    loops_.clear();
+    libusb_exit(usb_context);
+}
+
+usb_manager& usb_manager::instance()
+{
+    static usb_manager ret;
+    return ret;
+}
+
+event_loop& usb_manager::add_loop()
+{
+    const size_t idx = loops_.size();
+    const int cpu = config_.cpus.empty() ? -1 : config_.cpus[idx % config_.cpus.size()];
+    libusb_context* context = usb_context;
+
+    if (idx > 0)
+    {
+        context = nullptr;
+        if (libusb_init(&context) != 0)
+        {
+            // Crowd the first loop rather than fail.
+            ps3eye_debug("can't create a libusb context for another event thread\n");
+            return *loops_[0];
+        }
+        set_log_level(context, _ps3eye_debug_status);
+    }
+
+    loops_.push_back(std::make_unique<event_loop>(context, idx > 0, cpu, config_.realtime_priority));
+    return *loops_.back();
+}
+
+event_loop& usb_manager::attach()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (loops_.empty())
+        add_loop();
+
+    event_loop* loop = loops_[0].get();
+
+    switch (config_.model)
+    {
+    case event_model::shared:
+        break;
+    case event_model::pooled:
+    {
+        const size_t n = std::max(1u, config_.threads);
+        while (loops_.size() < n && &add_loop() != loops_[0].get())
+            ;
+        // Fill the threads evenly, also after cameras were closed.
+        for (size_t i = 0; i < std::min(n, loops_.size()); i++)
+            if (loops_[i]->attached_ < loop->attached_)
+                loop = loops_[i].get();
+        break;
+    }
+    case event_model::per_camera:
+    {
+        auto it = std::find_if(loops_.begin(), loops_.end(), [](const auto& x) { return x->attached_ == 0; });
+        loop = it != loops_.end() ? it->get() : &add_loop();
+        break;
+    }
+    }
+
+    loop->attached_++;
+    open_cameras_++;
+    return *loop;
+}
+
+void usb_manager::detach(event_loop& loop)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(loop.attached_ > 0 && open_cameras_ > 0);
+    loop.attached_--;
+    open_cameras_--;
+}
+
+bool usb_manager::set_event_threads(const event_thread_config& config)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (open_cameras_ > 0)
+        return false;
+
+    // The loops are made again as cameras are opened.
+    config_ = config;
+    loops_.clear();
+    return true;
 }
 
 std::vector<std::shared_ptr<camera>> usb_manager::list_devices()
@@ -120,9 +288,12 @@ void usb_manager::set_debug(bool value)
         return;
 
     _ps3eye_debug_status = value;
-    libusb_set_option(usb_context,
-                      LIBUSB_OPTION_LOG_LEVEL,
-                      value ? LIBUSB_LOG_LEVEL_INFO : LIBUSB_LOG_LEVEL_NONE);
+    set_log_level(usb_context, value);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& loop : loops_)
+        if (loop->owns_context_)
+            set_log_level(loop->context(), value);
 }
 
 } // ns ps3eye::detail
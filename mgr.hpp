@@ -5,6 +5,8 @@
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <mutex>
 
 struct libusb_context;
 struct libusb_device;
@@ -12,6 +14,44 @@ struct libusb_device_handle;
 
 namespace ps3eye::detail {
 
+// A libusb context and the thread handling its events while any of its
+// cameras stream. libusb handles a context's events on one thread at a
+// time, so spreading cameras over threads takes a context for each.
+struct event_loop final
+{
+    event_loop(libusb_context* context, bool owns_context, int cpu, int priority);
+    ~event_loop();
+
+    libusb_context* context() const { return context_; }
+    // The same device as `device` from another context, referenced, or
+    // nullptr if it's gone.
+    libusb_device* find(libusb_device* device) const;
+
+    void camera_started();
+    void camera_stopped();
+
+    event_loop(const event_loop&) = delete;
+    void operator=(const event_loop&) = delete;
+
+private:
+    friend struct usb_manager;
+
+    void start_xfer_thread();
+    void stop_xfer_thread();
+    void xfer_callback();
+
+    libusb_context* context_ = nullptr;
+    bool owns_context_ = false;
+    int cpu_ = -1;
+    int priority_ = 0;
+    // Cameras opened in this context; guarded by the usb_manager.
+    unsigned attached_ = 0;
+
+    std::thread update_thread;
+    std::atomic_int active_camera_count = 0;
+    std::atomic_bool exit_signaled = false;
+};
+
 struct usb_manager
 {
     usb_manager();
@@ -19,24 +59,33 @@ struct usb_manager
 
     static usb_manager& instance();
     std::vector<std::shared_ptr<camera>> list_devices();
-    void camera_started();
-    void camera_stopped();
+
+    // Pick the event loop for a camera being opened, and let it go when
+    // the camera is closed.
+    event_loop& attach();
+    void detach(event_loop& loop);
+
+    // Only while no camera is open.
+    bool set_event_threads(const event_thread_config& config);
 
     void set_debug(bool value);
 
 private:
+    event_loop& add_loop();
+
+    // Devices are enumerated in the context of the first loop; the shared
+    // model handles all events there too.
     libusb_context* usb_context = nullptr;
-    std::thread update_thread;
-    std::atomic_int active_camera_count = 0;
-    std::atomic_bool exit_signaled = false;
+
+    std::mutex mutex_;
+    event_thread_config config_;
+    std::vector<std::unique_ptr<event_loop>> loops_;
+    unsigned open_cameras_ = 0;
+    unsigned next_loop_ = 0;
 
     usb_manager(const usb_manager&);
     void operator=(const usb_manager&);
 
-    void start_xfer_thread();
-    void stop_xfer_thread();
-    void xfer_callback();
-
     //int sTotalDevices = 0;
 };
 
@@ -1,4 +1,5 @@
 #include "ps3eye.hpp"
+#include <atomic>
 #include <thread>
 #include <chrono>
 #include <cstdlib>
@@ -10,8 +11,7 @@ static bool test(ps3eye::camera& cam, int fps, ps3eye::resolution res)
     if (!cam.init(res, fps)) { fprintf(stderr, "failed to init camera\n"); return false; }
     if (!cam.start()) { fprintf(stderr, "failed to start camera\n"); return false; }
 
-    auto [ w, h ] = cam.size();
-    auto size = unsigned(w*h*cam.bytes_per_pixel());
+    auto size = unsigned(cam.frame_size());
     buf.reserve(size);
 
     bool ret = false;
@@ -66,6 +66,35 @@ static bool iter_modes(ps3eye::camera& cam, ps3eye::resolution res)
     return status;
 }
 
+// While a frame callback runs, polling must stay out of the ring.
+static bool test_callback(ps3eye::camera& cam)
+{
+    using namespace std::chrono_literals;
+    std::atomic<unsigned> frames = 0;
+    std::vector<uint8_t> buf;
+
+    cam.set_frame_callback([&](const uint8_t*, const ps3eye::frame_metadata&) { frames++; });
+    if (!cam.init(ps3eye::res_QVGA, 60)) { fprintf(stderr, "failed to init camera\n"); return false; }
+    if (!cam.start()) { fprintf(stderr, "failed to start camera\n"); return false; }
+
+    buf.resize(unsigned(cam.frame_size()));
+    bool ret = true;
+    ret &= cam.get_frame(buf.data(), 100ms) == ps3eye::frame_status::busy;
+    ret &= cam.try_get_frame(buf.data()) == ps3eye::frame_status::busy;
+    ret &= !cam.acquire_frame(100ms);
+
+    for (unsigned k = 0; k < 50 && frames < 5; k++)
+        std::this_thread::sleep_for(20ms);
+    ret &= frames >= 5;
+
+    cam.stop();
+    cam.set_frame_callback(nullptr);
+
+    printf("[%s] frame callback\n", ret ? "GOOD" : "FAIL");
+
+    return ret;
+}
+
 int main(void)
 {
     ps3eye::camera::set_debug(true);
@@ -83,6 +112,7 @@ int main(void)
 
     status &= iter_modes(*cam, ps3eye::res_QVGA);
     status &= iter_modes(*cam, ps3eye::res_VGA);
+    status &= test_callback(*cam);
 
     ps3eye::camera::set_debug(false);
 
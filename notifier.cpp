@@ -0,0 +1,102 @@
+#include "notifier.hpp"
+
+#if defined __linux__
+#   include <sys/eventfd.h>
+#   include <unistd.h>
+#   include <cstdint>
+#elif defined __unix__ || defined __APPLE__
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+namespace ps3eye::detail {
+
+#if defined __linux__
+
+int poll_notifier::open()
+{
+    if (read_fd_ < 0)
+    {
+        read_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        write_fd_.store(read_fd_, std::memory_order_release);
+    }
+    return read_fd_;
+}
+
+poll_notifier::~poll_notifier()
+{
+    if (read_fd_ >= 0)
+        ::close(read_fd_);
+}
+
+void poll_notifier::notify()
+{
+    int fd = write_fd_.load(std::memory_order_acquire);
+    uint64_t one = 1;
+    if (fd >= 0)
+        (void)!::write(fd, &one, sizeof(one));
+}
+
+void poll_notifier::drain()
+{
+    uint64_t value;
+    if (read_fd_ >= 0)
+        (void)!::read(read_fd_, &value, sizeof(value));
+}
+
+#elif defined __unix__ || defined __APPLE__
+
+int poll_notifier::open()
+{
+    if (read_fd_ < 0)
+    {
+        int fds[2];
+        if (pipe(fds) != 0)
+            return -1;
+        for (int fd : fds)
+        {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        read_fd_ = fds[0];
+        write_fd_.store(fds[1], std::memory_order_release);
+    }
+    return read_fd_;
+}
+
+poll_notifier::~poll_notifier()
+{
+    if (read_fd_ >= 0)
+    {
+        ::close(read_fd_);
+        ::close(write_fd_.load(std::memory_order_relaxed));
+    }
+}
+
+void poll_notifier::notify()
+{
+    // A full pipe is readable already.
+    int fd = write_fd_.load(std::memory_order_acquire);
+    char c = 0;
+    if (fd >= 0)
+        (void)!::write(fd, &c, 1);
+}
+
+void poll_notifier::drain()
+{
+    char buf[64];
+    if (read_fd_ >= 0)
+        while (::read(read_fd_, buf, sizeof(buf)) > 0)
+            ;
+}
+
+#else
+
+int poll_notifier::open() { return -1; }
+poll_notifier::~poll_notifier() = default;
+void poll_notifier::notify() {}
+void poll_notifier::drain() {}
+
+#endif
+
+} // ns ps3eye::detail
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+
+namespace ps3eye::detail {
+
+// A file descriptor that becomes readable on notify(), for callers that
+// wait in poll()/epoll() rather than in the driver. An eventfd on Linux,
+// a pipe on other Unices; not available on Windows.
+struct poll_notifier final
+{
+    poll_notifier() = default;
+    ~poll_notifier();
+
+    // Create the descriptor if needed. -1 if it can't be.
+    int open();
+    bool is_open() const { return write_fd_.load(std::memory_order_acquire) >= 0; }
+
+    // Any thread. Cheap no-op until open().
+    void notify();
+    // Make the descriptor unreadable again.
+    void drain();
+
+    poll_notifier(const poll_notifier&) = delete;
+    void operator=(const poll_notifier&) = delete;
+
+private:
+    int read_fd_ = -1;
+    std::atomic<int> write_fd_ = -1;
+};
+
+} // ns ps3eye::detail
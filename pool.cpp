@@ -0,0 +1,100 @@
+#include "pool.hpp"
+
+#include <algorithm>
+
+namespace ps3eye::detail {
+
+worker_pool::worker_pool() = default;
+
+worker_pool::~worker_pool()
+{
+    stop_workers();
+}
+
+void worker_pool::set_threads(unsigned n)
+{
+    n = std::max(n, 1u);
+    if (n == threads())
+        return;
+
+    stop_workers();
+
+    // New workers mustn't take the last run() for one they have yet to do.
+    workers_.reserve(n - 1);
+    for (unsigned i = 1; i < n; i++)
+        workers_.emplace_back(&worker_pool::worker, this, i, generation_);
+}
+
+void worker_pool::stop_workers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        exit_ = true;
+    }
+    start_.notify_all();
+
+    for (std::thread& t : workers_)
+        t.join();
+    workers_.clear();
+
+    exit_ = false;
+}
+
+void worker_pool::run_(unsigned n, task_fn fn, void* data)
+{
+    if (n == 0)
+        return;
+
+    unsigned n_workers = std::min(n, threads()) - 1;
+
+    if (n_workers > 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fn_ = fn;
+        data_ = data;
+        num_tasks_ = n;
+        pending_ = n_workers;
+        generation_++;
+        start_.notify_all();
+    }
+
+    // Tasks past the number of threads are run here after task 0.
+    fn(data, 0);
+    for (unsigned i = n_workers + 1; i < n; i++)
+        fn(data, i);
+
+    if (n_workers > 0)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+    }
+}
+
+void worker_pool::worker(unsigned idx, unsigned generation)
+{
+    for (;;)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&] { return exit_ || generation_ != generation; });
+
+        if (exit_)
+            return;
+
+        generation = generation_;
+
+        if (idx >= num_tasks_)
+            continue;
+
+        task_fn fn = fn_;
+        void* data = data_;
+        lock.unlock();
+
+        fn(data, idx);
+
+        lock.lock();
+        if (--pending_ == 0)
+            done_.notify_one();
+    }
+}
+
+} // ns ps3eye::detail
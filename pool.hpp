@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ps3eye::detail {
+
+// Small fork-join pool. run(n, fn) calls fn(0) .. fn(n-1), fn(0) on the
+// calling thread and the rest on workers, then waits for all of them.
+struct worker_pool final
+{
+    explicit worker_pool();
+    ~worker_pool();
+
+    // Total number of threads including the caller. 1 means no workers.
+    void set_threads(unsigned n);
+    unsigned threads() const { return unsigned(workers_.size()) + 1; }
+
+    template<typename F>
+    void run(unsigned n, F&& fn)
+    {
+        run_(n, [](void* data, unsigned i) { (*static_cast<F*>(data))(i); }, &fn);
+    }
+
+    worker_pool(const worker_pool&) = delete;
+    void operator=(const worker_pool&) = delete;
+
+private:
+    using task_fn = void(*)(void* data, unsigned i);
+
+    void run_(unsigned n, task_fn fn, void* data);
+    void worker(unsigned idx, unsigned generation);
+    void stop_workers();
+
+    std::mutex mutex_;
+    std::condition_variable start_, done_;
+    std::vector<std::thread> workers_;
+
+    task_fn fn_ = nullptr;
+    void* data_ = nullptr;
+    unsigned num_tasks_ = 0;
+    unsigned pending_ = 0;
+    unsigned generation_ = 0;
+    bool exit_ = false;
+};
+
+} // ns ps3eye::detail
@@ -2,6 +2,8 @@
 #include "ps3eye.hpp"
 #include "urb.hpp"
 #include "mgr.hpp"
+#include "transport.hpp"
+#include "replay.hpp"
 #include "internal.hpp"
 
 #include <atomic>
@@ -201,26 +203,40 @@ static const uint8_t sensor_start_qvga[][2] = {
     { 0x65, 0x2f },
 };
 
-camera::camera(libusb_device* device) : device_(device)
+// Gain, exposure and white balance, which AGC, AEC and AWB adjust.
+static void mark_automatic_registers(ps3eye::detail::register_shadow& sensor)
 {
+    for (uint8_t reg : { 0x00, 0x01, 0x02, 0x03, 0x08, 0x10, 0x42, 0x43, 0x44 })
+        sensor.set_volatile(reg);
+}
+
+camera::camera(libusb_device* device) :
+    transport_(std::make_unique<ps3eye::detail::libusb_transport>(device))
+{
+    mark_automatic_registers(sensor_shadow_);
+}
+
+camera::camera(std::unique_ptr<ps3eye::detail::transport> transport) :
+    transport_(std::move(transport))
+{
+    mark_automatic_registers(sensor_shadow_);
 }
 
 camera::~camera()
 {
+    // Write what's queued while the device is still open.
+    controls_ = nullptr;
     stop();
     release();
-    if (device_)
-        libusb_unref_device(device_);
 }
 
 void camera::release()
 {
-    if (handle_)
+    if (is_open_usb_)
     {
         stop();
         close_usb();
     }
-    handle_ = nullptr;
     set_error(NO_ERROR);
 }
 
@@ -234,25 +250,55 @@ void camera::set_error(int code)
     }
 }
 
-bool camera::init(resolution res, int framerate, format fmt)
+// Stores the time since the last lap in `phase`.
+struct phase_timer final
 {
+    using clock = std::chrono::steady_clock;
+
+    void lap(startup_timing::duration& phase)
+    {
+        auto now = clock::now();
+        phase = std::chrono::duration_cast<startup_timing::duration>(now - last_);
+        last_ = now;
+    }
+
+private:
+    clock::time_point last_ = clock::now();
+};
+
+bool camera::init(resolution res, int framerate, format fmt, output_scale scale)
+{
+    if (scale == output_scale::half && fmt != format::BGR && fmt != format::RGB &&
+        fmt != format::BGRA && fmt != format::RGBA && fmt != format::Gray)
+    {
+        ps3eye_debug("format %d can't be binned\n", (int)fmt);
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    phase_timer timer;
+    timing_ = {};
+
     set_error(NO_ERROR);
     stop();
     if (error_code_ != NO_ERROR)
         release();
 
     // open usb device so we can setup and go
-    if (!handle_ && !open_usb())
+    if (!is_open_usb_ && !open_usb())
         return false;
+    timer.lap(timing_.open);
 
     resolution_ = res;
 
     framerate_ = ov534_set_frame_rate(framerate, true);
     format_ = fmt;
+    scale_ = scale;
 
     /* reset bridge */
     ov534_reg_write(0xe7, 0x3a);
     ov534_reg_write(0xe0, 0x08);
+    bridge_shadow_.clear();
 
     std::this_thread::sleep_for(10ms);
 
@@ -263,6 +309,7 @@ bool camera::init(resolution res, int framerate, format fmt)
     sccb_reg_write(0x12, 0x80);
 
     std::this_thread::sleep_for(10ms);
+    timer.lap(timing_.reset);
 
 #if 0
     /* probe the sensor */
@@ -275,10 +322,12 @@ bool camera::init(resolution res, int framerate, format fmt)
 
     /* initialize */
     reg_w_array(ov534_reg_initdata, std::size(ov534_reg_initdata));
+    timer.lap(timing_.bridge_init);
     //ov534_set_led(1);
     sccb_w_array(ov772x_reg_initdata, std::size(ov772x_reg_initdata));
     ov534_reg_write(0xe0, 0x09);
     //ov534_set_led(0);
+    timer.lap(timing_.sensor_init);
 
     return true;
 }
@@ -288,6 +337,39 @@ bool camera::start()
     if (!is_initialized() || streaming_ || error_code_ != NO_ERROR)
         return false;
 
+    std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+    phase_timer timer;
+    auto [ w, h ] = sensor_size();
+
+    if (!urb.queue.reserve(unsigned(w * h), unsigned(queue_depth_), frame_memory_, frame_memory_size_))
+        return false;
+    urb.queue.set_drop_policy(drop_policy_);
+    urb.configure_transfers(unsigned(transfer_count_), unsigned(transfer_size_), unsigned(w * h), framerate_);
+
+    delivering_ = frame_callback_;
+    delivery_stopped_ = false;
+    if (delivering_)
+    {
+        delivery_frame_.resize(size_t(frame_size()));
+        // start its threads here rather than on the USB thread
+        (void)ps3eye::detail::delivery_pool::instance();
+        urb.queue.set_frame_hook([](void* data) {
+            ps3eye::detail::delivery_pool::instance().post(static_cast<camera*>(data)->delivery_);
+        }, this);
+    }
+    else
+        urb.queue.set_frame_hook(nullptr, nullptr);
+
+    if (!recording_path_.empty())
+    {
+        urb.recorder = std::make_unique<ps3eye::detail::capture_recorder>();
+        if (!urb.recorder->open(recording_path_.c_str(), unsigned(w * h)))
+        {
+            urb.recorder = nullptr;
+            return false;
+        }
+    }
+
     if (resolution_ == res_QVGA)
     { /* 320x240 */
         reg_w_array(bridge_start_qvga, std::size(bridge_start_qvga));
@@ -300,28 +382,43 @@ bool camera::start()
     }
 
     ov534_set_frame_rate(framerate_);
+    timer.lap(timing_.start_registers);
 
     set_hue(hue_);
     set_saturation(saturation_);
+    // These write the manual gain, exposure and balances when turned off,
+    // so only write them again when they're the starting point instead.
     set_awb(awb_);
     set_auto_gain(auto_gain_);
-    set_gain(gain_);
-    set_exposure(exposure_);
+    if (!fast_init_ || auto_gain_)
+    {
+        set_gain(gain_);
+        set_exposure(exposure_);
+    }
     set_brightness(brightness_);
     set_contrast(contrast_);
     set_sharpness(sharpness_);
-    set_red_balance(red_balance_);
-    set_blue_balance(blue_balance_);
-    set_green_balance(green_balance_);
+    if (!fast_init_ || awb_)
+    {
+        set_red_balance(red_balance_);
+        set_blue_balance(blue_balance_);
+        set_green_balance(green_balance_);
+    }
     set_flip_status(flip_h_, flip_v_);
 
     ov534_set_led(1);
     ov534_reg_write(0xe0, 0x00); // start stream
+    timer.lap(timing_.controls);
 
     // init and start urb
-    auto [ w, h ] = size();
-    urb.start_transfers(handle_, unsigned(w * h));
+    if (!transport_->start_stream(urb, unsigned(w * h)))
+    {
+        ps3eye_debug("can't start streaming\n");
+        urb.recorder = nullptr;
+        return false;
+    }
     streaming_ = true;
+    timer.lap(timing_.stream);
 
     return true;
 }
@@ -331,127 +428,216 @@ void camera::stop()
     if (!streaming_)
         return;
 
-    if (handle_)
+    // A never_drop queue may be holding up the USB thread.
+    urb.queue.shutdown();
+
+    if (is_open_usb_)
     {
         /* stop streaming data */
-        ov534_reg_write(0xe0, 0x09);
-        ov534_set_led(0);
+        {
+            std::lock_guard<std::recursive_mutex> lock(control_mutex_);
+            ov534_reg_write(0xe0, 0x09);
+            ov534_set_led(0);
+        }
 
         // close urb
-        urb.close_transfers();
+        transport_->stop_stream(urb);
+    }
+
+    // No more frames come in, wait for the one being delivered.
+    if (delivering_)
+    {
+        ps3eye::detail::delivery_pool::instance().cancel(delivery_);
+        delivery_stopped_ = true;
     }
 
+    urb.recorder = nullptr;
+
     streaming_ = false;
 }
 
-#define MAX_USB_DEVICE_PORT_PATH 7
+void camera::deliver_frames(void* data)
+{
+    camera& cam = *static_cast<camera*>(data);
+    auto [ w, h ] = cam.sensor_size();
+    frame_metadata meta;
+
+    // Until the ring is empty, which re-arms the frame hook. stop() may
+    // be called from the callback.
+    while (!cam.delivery_stopped_ && cam.error_code_ == NO_ERROR &&
+           cam.urb.queue.dequeue(cam.delivery_frame_.data(), w, h, cam.output(), &meta,
+                                 std::chrono::microseconds::zero()))
+        cam.delivering_(cam.delivery_frame_.data(), meta);
+}
 
 bool camera::usb_port(char* buf, unsigned sz) const
 {
-    bool success = false;
+    return is_initialized() && transport_->port_path(buf, sz);
+}
 
-    if (is_initialized())
-    {
-        uint8_t port_numbers[MAX_USB_DEVICE_PORT_PATH];
+libusb_device* camera::device() const
+{
+    return transport_->device();
+}
 
-        memset(buf, 0, sz);
-        memset(port_numbers, 0, sizeof(port_numbers));
+int camera::bytes_per_pixel() const
+{
+    return detail::bytes_per_pixel(format_);
+}
 
-        int cnt = libusb_get_port_numbers(device_, port_numbers, MAX_USB_DEVICE_PORT_PATH);
-        int bus_id = libusb_get_bus_number(device_);
+detail::frame_output camera::output(const frame_roi* rois, unsigned count) const
+{
+    return { format_, stride(), scale_, demosaic_, rois, count };
+}
 
-        snprintf(buf, sz, "b%d", bus_id);
+int camera::frame_size() const
+{
+    int size = stride() * height();
+    if (format_ == format::NV12 || format_ == format::I420)
+        size += size / 2;
+    return size;
+}
 
-        if (cnt > 0)
-        {
-            success = true;
-
-            for (int i = 0; i < cnt; i++)
-            {
-                uint8_t port_number = port_numbers[i];
-                char port_string[8];
-
-                snprintf(port_string, sizeof(port_string),
-                         (i == 0) ? "_p%d" : ".%d", port_number);
-
-                if (strlen(buf) + strlen(port_string) + 1 <= sz)
-                    std::strcat(buf, port_string);
-                else
-                {
-                    success = false;
-                    break;
-                }
-            }
-        }
-    }
+bool camera::get_frame(uint8_t* frame, frame_metadata* meta)
+{
+    return get_frame(frame, detail::frame_queue::default_timeout, meta) == frame_status::ok;
+}
 
-    return success;
+frame_status camera::get_frame(uint8_t* frame, std::chrono::microseconds timeout, frame_metadata* meta)
+{
+    return get_frame(frame, nullptr, 0, timeout, meta);
 }
 
-int camera::bytes_per_pixel() const
+frame_status camera::get_frame(uint8_t* frame, const frame_roi& roi, std::chrono::microseconds timeout,
+                               frame_metadata* meta)
 {
-    if (format_ == format::Bayer)
-        return 1;
-    else if (format_ == format::BGR)
-        return 3;
-    else if (format_ == format::RGB)
-        return 3;
-    else if (format_ == format::Gray)
-        return 1;
-    return 0;
+    return get_frame(frame, &roi, 1, timeout, meta);
 }
 
-bool camera::get_frame(uint8_t* frame)
+frame_status camera::get_frame(uint8_t* frame, const frame_roi* rois, unsigned count,
+                               std::chrono::microseconds timeout, frame_metadata* meta)
 {
     if (!streaming_)
-        return false;
+        return frame_status::not_streaming;
 
-    if (error_code_ != NO_ERROR && handle_)
+    // the frame callback is the ring's only consumer
+    if (delivering_)
+        return frame_status::busy;
+
+    if (error_code_ != NO_ERROR && is_open_usb_)
     {
         stop();
         release();
-        return false;
+        return frame_status::error;
     }
 
-    auto [ w, h ] = size();
-    return urb.queue.dequeue(frame, w, h, format_);
+    if (urb.queue.leased())
+        return frame_status::busy;
+
+    auto [ w, h ] = sensor_size();
+    if (!urb.queue.dequeue(frame, w, h, output(rois, count), meta, timeout))
+        return frame_status::timeout;
+    return frame_status::ok;
 }
 
-bool camera::open_usb()
+frame_status camera::try_get_frame(uint8_t* frame, frame_metadata* meta)
 {
-    // open, set first config and claim interface
-    int res = libusb_open(device_, &handle_);
-    if (res != 0)
+    return get_frame(frame, std::chrono::microseconds::zero(), meta);
+}
+
+int camera::frame_fd()
+{
+    return urb.queue.poll_fd();
+}
+
+frame_lease camera::acquire_frame(std::chrono::microseconds timeout)
+{
+    if (!streaming_ || delivering_)
+        return {};
+
+    if (error_code_ != NO_ERROR && is_open_usb_)
     {
-        ps3eye_debug("device open error: %d\n", res);
-        set_error(res);
-        return false;
+        stop();
+        release();
+        return {};
     }
 
-    // Linux has a kernel module for the PS3 eye camera (that's where most of
-    // the code in here comes from..) so we must detach the driver before we can
-    // hook up with the eye ourselves
-    libusb_detach_kernel_driver(handle_, 0);
+    frame_metadata meta;
+    const uint8_t* data = urb.queue.acquire(meta, timeout);
+    if (!data)
+        return {};
 
-    // libusb_set_configuration(handle_, 0);
+    return { &urb.queue, data, urb.queue.frame_size(), meta };
+}
 
-    res = libusb_claim_interface(handle_, 0);
+void camera::convert_frame(const frame_lease& lease, uint8_t* frame)
+{
+    if (!lease)
+        return;
+
+    auto [ w, h ] = sensor_size();
+    urb.queue.convert(lease.data(), frame, w, h, output());
+}
+
+frame_lease::frame_lease(ps3eye::detail::frame_queue* queue, const uint8_t* data,
+                         unsigned size, const frame_metadata& meta) :
+    queue_(queue), data_(data), size_(size), meta_(meta)
+{
+}
+
+frame_lease::~frame_lease()
+{
+    release();
+}
+
+frame_lease::frame_lease(frame_lease&& other) noexcept :
+    queue_(other.queue_), data_(other.data_), size_(other.size_), meta_(other.meta_)
+{
+    other.queue_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+frame_lease& frame_lease::operator=(frame_lease&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        std::swap(queue_, other.queue_);
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        std::swap(meta_, other.meta_);
+    }
+    return *this;
+}
+
+void frame_lease::release()
+{
+    if (queue_)
+        queue_->release();
+    queue_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+}
+
+bool camera::open_usb()
+{
+    int res = transport_->open();
     if (res != 0)
     {
-        ps3eye_debug("device claim interface error: %d\n", res);
         set_error(res);
+        transport_->close();
         return false;
     }
 
+    is_open_usb_ = true;
     return true;
 }
 
 void camera::close_usb()
 {
-    libusb_release_interface(handle_, 0);
-    libusb_attach_kernel_driver(handle_, 0);
-    libusb_close(handle_);
-    handle_ = nullptr;
+    transport_->close();
+    is_open_usb_ = false;
 }
 
 /* Two bits control LED: 0x21 bit 7 and 0x23 bit 7.
@@ -462,11 +648,11 @@ void camera::ov534_set_led(int status)
 
     //ps3eye_debug("led status: %d\n", status);
 
-    data = ov534_reg_read(0x21);
+    data = ov534_reg_cached(0x21);
     data |= 0x80;
     ov534_reg_write(0x21, data);
 
-    data = ov534_reg_read(0x23);
+    data = ov534_reg_cached(0x23);
     if (status)
         data |= 0x80;
     else
@@ -476,7 +662,7 @@ void camera::ov534_set_led(int status)
 
     if (!status)
     {
-        data = ov534_reg_read(0x21);
+        data = ov534_reg_cached(0x21);
         data &= ~0x80;
         ov534_reg_write(0x21, data);
     }
@@ -568,15 +754,15 @@ void camera::ov534_reg_write(uint16_t reg, uint8_t val)
     if (error_code_ != NO_ERROR)
         return;
 
-    int ret;
-
-    // debug("reg=0x%04x, val=0%02x", reg, val);
-    usb_buf[0] = val;
-
-    ret = libusb_control_transfer(handle_, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
-                                  0x01, 0x00, reg, usb_buf.data(), 1, 500);
+    timing_.control_writes++;
+    int ret = transport_->reg_write(reg, val);
     if (ret < 0)
+    {
         error_code_ = ret;
+        bridge_shadow_.forget(reg);
+    }
+    else
+        bridge_shadow_.set(reg, val);
 }
 
 uint8_t camera::ov534_reg_read(uint16_t reg)
@@ -584,19 +770,16 @@ uint8_t camera::ov534_reg_read(uint16_t reg)
     if (error_code_ != NO_ERROR)
         return 0;
 
-    int ret;
-
-    ret = libusb_control_transfer(handle_, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
-                                  0x01, 0x00, reg, usb_buf.data(), 1, 500);
-
-    // debug("reg=0x%04x, data=0x%02x", reg, usb_buf[0]);
+    uint8_t val;
+    timing_.control_reads++;
+    int ret = transport_->reg_read(reg, val);
     if (ret < 0)
     {
         error_code_ = ret;
         return 0;
     }
     else
-        return usb_buf[0];
+        return val;
 }
 
 bool camera::sccb_check_status()
@@ -639,11 +822,38 @@ end:
 void camera::sccb_reg_write(uint8_t reg, uint8_t val)
 {
     // debug("reg: 0x%02x, val: 0x%02x", reg, val);
-    ov534_reg_write(OV534_REG_SUBADDR, reg);
-    ov534_reg_write(OV534_REG_WRITE, val);
-    ov534_reg_write(OV534_REG_OPERATION, OV534_OP_WRITE_3);
+    if (fast_init_)
+    {
+        // COM7 writes reset or switch modes, send them even if unchanged.
+        uint8_t cur;
+        if (reg != 0x12 && sensor_shadow_.get(reg, cur) && cur == val)
+        {
+            timing_.sensor_writes_skipped++;
+            return;
+        }
 
-    (void)sccb_check_status();
+        // The SCCB master only needs polling once it's been kicked off.
+        const uint8_t op[][2] = {
+            { OV534_REG_SUBADDR, reg },
+            { OV534_REG_WRITE, val },
+            { OV534_REG_OPERATION, OV534_OP_WRITE_3 },
+        };
+        ov534_reg_write_array(op, std::size(op));
+    }
+    else
+    {
+        ov534_reg_write(OV534_REG_SUBADDR, reg);
+        ov534_reg_write(OV534_REG_WRITE, val);
+        ov534_reg_write(OV534_REG_OPERATION, OV534_OP_WRITE_3);
+    }
+
+    // A reset puts every register back to its default.
+    if (reg == 0x12 && (val & 0x80))
+        sensor_shadow_.clear();
+    else if (sccb_check_status())
+        sensor_shadow_.set(reg, val);
+    else
+        sensor_shadow_.forget(reg);
 }
 
 uint8_t camera::sccb_reg_read(uint16_t reg)
@@ -657,9 +867,55 @@ uint8_t camera::sccb_reg_read(uint16_t reg)
 
     return ov534_reg_read(OV534_REG_READ);
 }
+
+uint8_t camera::ov534_reg_cached(uint16_t reg)
+{
+    uint8_t val;
+    if (!bridge_shadow_.get(reg, val))
+    {
+        val = ov534_reg_read(reg);
+        if (error_code_ == NO_ERROR)
+            bridge_shadow_.set(reg, val);
+    }
+    return val;
+}
+
+uint8_t camera::sccb_reg_cached(uint8_t reg)
+{
+    uint8_t val;
+    if (!sensor_shadow_.get(reg, val))
+    {
+        val = (uint8_t)sccb_reg_read(reg);
+        if (error_code_ == NO_ERROR)
+            sensor_shadow_.set(reg, val);
+    }
+    return val;
+}
+void camera::ov534_reg_write_array(const uint8_t (*data)[2], int len)
+{
+    if (error_code_ != NO_ERROR)
+        return;
+
+    timing_.control_writes += unsigned(len);
+    int ret = transport_->reg_write_array(data, unsigned(len));
+    if (ret < 0)
+    {
+        // No telling which of them made it.
+        error_code_ = ret;
+        bridge_shadow_.clear();
+        return;
+    }
+
+    for (int i = 0; i < len; i++)
+        bridge_shadow_.set(data[i][0], data[i][1]);
+}
+
 /* output a bridge sequence (reg - val) */
 void camera::reg_w_array(const uint8_t (*data)[2], int len)
 {
+    if (fast_init_)
+        return ov534_reg_write_array(data, len);
+
     while (--len >= 0)
     {
         if (error_code_ != NO_ERROR)
@@ -692,7 +948,7 @@ const char* camera::error_string() const
     if (error_code_ == NO_ERROR)
         return nullptr;
 
-    return libusb_strerror((libusb_error)error_code_);
+    return libusb_strerror((libusb_error)error_code_.load());
 }
 
 } // namespace ps3eye::detail
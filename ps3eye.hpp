@@ -3,16 +3,26 @@
 
 #include "urb.hpp"
 #include "setter.hpp"
+#include "delivery.hpp"
+#include "shadow.hpp"
+#include "control.hpp"
 
+#include <algorithm>
 #include <vector>
 #include <array>
+#include <atomic>
 #include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <utility>
 
 struct libusb_device;
-struct libusb_device_handle;
 
 namespace ps3eye::detail {
+struct transport;
 struct rate_s
 {
     int fps;
@@ -37,66 +47,237 @@ static constexpr inline auto fmt_RGB = format::RGB;
 static constexpr inline auto fmt_BGR = format::BGR;
 static constexpr inline auto fmt_Gray = format::Gray;
 static constexpr inline auto fmt_Bayer = format::Bayer;
+static constexpr inline auto fmt_NV12 = format::NV12;
+static constexpr inline auto fmt_I420 = format::I420;
+static constexpr inline auto fmt_YUYV = format::YUYV;
+static constexpr inline auto fmt_BGRA = format::BGRA;
+static constexpr inline auto fmt_RGBA = format::RGBA;
+
+// A frame borrowed from the camera's ring buffer, in Bayer format. The
+// driver won't write to it until the lease is released or destroyed. Only
+// one lease per camera can be held at a time, and it must be released
+// before the camera is stopped.
+struct frame_lease final
+{
+    frame_lease() = default;
+    ~frame_lease();
+    frame_lease(frame_lease&& other) noexcept;
+    frame_lease& operator=(frame_lease&& other) noexcept;
+
+    explicit operator bool() const { return data_ != nullptr; }
+
+    const uint8_t* data() const { return data_; }
+    unsigned size() const { return size_; }
+    uint64_t sequence() const { return meta_.sequence; }
+    std::chrono::steady_clock::time_point timestamp() const { return meta_.timestamp; }
+    const frame_metadata& metadata() const { return meta_; }
+
+    void release();
+
+    frame_lease(const frame_lease&) = delete;
+    void operator=(const frame_lease&) = delete;
+
+private:
+    friend struct camera;
+    frame_lease(ps3eye::detail::frame_queue* queue, const uint8_t* data, unsigned size, const frame_metadata& meta);
+
+    ps3eye::detail::frame_queue* queue_ = nullptr;
+    const uint8_t* data_ = nullptr;
+    unsigned size_ = 0;
+    frame_metadata meta_;
+};
 
 struct camera
 {
     explicit camera(libusb_device* device);
+    explicit camera(std::unique_ptr<ps3eye::detail::transport> transport);
     ~camera();
 
-    [[nodiscard]] bool init(resolution res, int framerate = 60, format fmt = format::BGR);
+    // output_scale::half bins 2x2 quads into pixels, e.g. 320x240 frames
+    // from VGA, for a fraction of the cost. Not for Bayer or YUV output.
+    [[nodiscard]] bool init(resolution res, int framerate = 60, format fmt = format::BGR,
+                            output_scale scale = output_scale::full);
     [[nodiscard]] bool start();
     void stop();
 
-    // Controls
-    constexpr bool auto_gain() const { return auto_gain_; }
+    // Controls. The getters wait for a write in progress from another
+    // thread.
+    bool auto_gain() const;
     void set_auto_gain(bool val);
-    constexpr bool awb() const { return awb_; }
+    bool awb() const;
     void set_awb(bool val);
-    constexpr uint8_t gain() const { return gain_; }
+    uint8_t gain() const;
     void set_gain(int val);
-    constexpr uint8_t exposure() const { return exposure_; }
+    uint8_t exposure() const;
     void set_exposure(int val);
-    constexpr uint8_t sharpness() const { return sharpness_; }
+    uint8_t sharpness() const;
     void set_sharpness(int val);
-    constexpr uint8_t contrast() const { return contrast_; }
+    uint8_t contrast() const;
     void set_contrast(int val);
-    constexpr uint8_t brightness() const { return brightness_; }
+    uint8_t brightness() const;
     void set_brightness(int val);
-    constexpr uint8_t hue() const { return hue_; }
+    uint8_t hue() const;
     void set_hue(int val);
-    constexpr uint8_t red_balance() const { return red_balance_; }
+    uint8_t red_balance() const;
     void set_red_balance(int val);
-    constexpr uint8_t blue_balance() const { return blue_balance_; }
+    uint8_t blue_balance() const;
     void set_blue_balance(int val);
-    constexpr uint8_t green_balance() const { return green_balance_; }
+    uint8_t green_balance() const;
     void set_green_balance(int val);
-    constexpr std::pair<bool, bool> flip_status() { return { flip_h_, flip_v_ }; }
+    std::pair<bool, bool> flip_status() const;
     void set_flip_status(bool horizontal = false, bool vertical = false);
-    constexpr bool test_pattern_status() const { return test_pattern_; }
+    bool test_pattern_status() const;
     void set_test_pattern_status(bool enable);
     constexpr int framerate() const { return framerate_; }
     void set_framerate(int val);
-    constexpr int saturation() const { return saturation_; }
+    int saturation() const;
     void set_saturation(int val);
 
+    // Interpolation of the missing colors, bilinear by default.
+    // demosaic::malvar shows less color fringing at edges, at about twice
+    // the CPU time. It applies to the BGR, RGB, BGRA and RGBA formats at
+    // full scale; the others stay bilinear. Before start() when using a
+    // frame callback.
+    constexpr demosaic demosaic_method() const { return demosaic_; }
+    void set_demosaic(demosaic method) { demosaic_ = method; }
+
+    // Threads debayering each frame in get_frame(), including the calling
+    // thread. Rows are split in bands; the output doesn't depend on it.
+    // Safe while streaming: the pool is resized before the next frame.
+    int debayer_threads() const;
+    void set_debayer_threads(int n);
+
+    // Frames buffered for get_frame(), 2 to 64, 5 by default. Fewer keeps
+    // latency down, more rides out a consumer that stalls now and then.
+    // Applies from the next start().
+    constexpr int frame_queue_depth() const { return queue_depth_; }
+    void set_frame_queue_depth(int n);
+
+    // Keep the frames in caller-owned memory of at least depth *
+    // sensor_size().first * sensor_size().second bytes instead, e.g. a
+    // slice of one arena for several cameras.
+    // It has to stay valid while streaming. nullptr goes back to memory of
+    // the camera's own. Applies from the next start().
+    void set_frame_memory(uint8_t* memory, size_t size);
+
+    // Which frame to drop when the consumer falls behind, see drop_policy.
+    // Applies from the next start().
+    constexpr drop_policy frame_drop_policy() const { return drop_policy_; }
+    void set_frame_drop_policy(drop_policy policy) { drop_policy_ = policy; }
+
+    // Bulk transfers kept queued with the host controller, 2 to 32, and
+    // their size, rounded up to whole 2048-byte payloads. More data in
+    // flight rides out longer stalls of the USB thread. 0 picks both from
+    // resolution and frame rate, about a frame in flight at up to 60 fps
+    // and up to four at the highest rates; stats() shows the outcome.
+    // 5 transfers of 64 KiB by default. Applies from the next start().
+    constexpr int usb_transfer_count() const { return transfer_count_; }
+    constexpr int usb_transfer_size() const { return transfer_size_; }
+    void set_usb_transfers(int count, int size);
+
+    // Change a control from any thread without waiting for the bus. A
+    // thread of the camera's own writes them in the order first queued;
+    // a control set again before it went out is written once, with the
+    // last value. The future or callback gets error_code() after the
+    // write, also for coalesced calls. Getters show the new value once
+    // it's written. The set_*() functions above wait for queued writes in
+    // progress and are safe from any thread too.
+    std::future<int> set_control_async(control c, int value);
+    void set_control_async(control c, int value, std::function<void(int error)> done);
+
+    // Program the camera faster in init() and start(): bridge registers
+    // go out as pipelined control transfers and sensor writes of values
+    // it holds already are skipped. On by default; off writes and polls
+    // each register in turn.
+    constexpr bool fast_init() const { return fast_init_; }
+    void set_fast_init(bool enable) { fast_init_ = enable; }
+    // Phases of the last init() and start().
+    constexpr const ps3eye::startup_timing& startup_timing() const { return timing_; }
+
+    // Push each frame to `fn` instead of queueing it for get_frame(). It
+    // runs on the threads shared by all cameras, see set_callback_threads(),
+    // right after the frame arrives and is converted to the output format
+    // there. Calls for one camera are in order and never overlap; `frame`
+    // is valid until the call returns. nullptr goes back to get_frame().
+    // Applies from the next start(); until stop(), get_frame() returns
+    // frame_status::busy and acquire_frame() an empty lease.
+    using frame_callback = std::function<void(const uint8_t* frame, const frame_metadata& meta)>;
+    void set_frame_callback(frame_callback fn) { frame_callback_ = std::move(fn); }
+
+    // Threads running frame callbacks, 1 to 64. 0 is the default, as many
+    // as there are cores up to 4. More than cameras don't help.
+    static void set_callback_threads(int n);
+
+    // Threads receiving USB transfers and assembling frames, see
+    // event_model. Takes effect only while no camera is open, else
+    // returns false.
+    static bool set_event_threads(const event_thread_config& config);
+
     constexpr bool is_open() const { return streaming_; }
-    constexpr bool is_initialized() const { return device_ && handle_; }
+    constexpr bool is_initialized() const { return is_open_usb_; }
 
-    constexpr libusb_device* device() const { return device_; }
+    // nullptr for replayed cameras
+    libusb_device* device() const;
     [[nodiscard]] bool usb_port(char* buf, unsigned sz) const;
 
     // Get a frame from the camera. Notes:
     // - If there is no frame available, this function will block until one is
     // - The output buffer must be sized correctly, depending out the output
     // format. See format.
-    [[nodiscard]] bool get_frame(uint8_t* frame);
-
+    [[nodiscard]] bool get_frame(uint8_t* frame, frame_metadata* meta = nullptr);
+    // As above, waiting at most `timeout` for a frame.
+    [[nodiscard]] frame_status get_frame(uint8_t* frame, std::chrono::microseconds timeout,
+                                         frame_metadata* meta = nullptr);
+    // Never waits. Returns frame_status::timeout if no frame is ready.
+    [[nodiscard]] frame_status try_get_frame(uint8_t* frame, frame_metadata* meta = nullptr);
+    // Only debayer the given rectangles of the output frame, writing them
+    // where a whole frame would have them and leaving the rest of `frame`
+    // alone. Their pixels are the same as get_frame()'s. Rectangles are
+    // clipped to the frame, YUYV widens them to even x. NV12 and I420
+    // convert the whole frame.
+    [[nodiscard]] frame_status get_frame(uint8_t* frame, const frame_roi* rois, unsigned count,
+                                         std::chrono::microseconds timeout, frame_metadata* meta = nullptr);
+    [[nodiscard]] frame_status get_frame(uint8_t* frame, const frame_roi& roi, std::chrono::microseconds timeout,
+                                         frame_metadata* meta = nullptr);
+
+    // A descriptor that polls readable while a frame may be ready, for
+    // event loops. Call try_get_frame() until it stops returning ok
+    // before polling again. -1 on Windows.
+    int frame_fd();
+
+    // Borrow the next frame without copying it. Returns an empty lease if
+    // no frame arrived in time, another lease is still held or frames go
+    // to a frame callback.
+    [[nodiscard]] frame_lease acquire_frame(std::chrono::microseconds timeout = std::chrono::milliseconds(50));
+
+    // Convert a leased frame to the output format, as get_frame() would.
+    void convert_frame(const frame_lease& lease, uint8_t* frame);
+
+    // Capture health counters since start(); safe to call from any thread.
+    capture_stats stats();
+
+    // Save the raw bulk transfers of every following start() to a capture
+    // file that open_replay() plays back. The file is overwritten each
+    // time. nullptr or "" turns recording off.
+    void set_recording(const char* path);
+
+    // Size of the output frames; half the sensor's with output_scale::half.
     inline int width() const { return size().first; }
     inline int height() const { return size().second; }
     std::pair<int, int> size() const;
+    // Size of the Bayer frames the sensor sends, and of leased frames.
+    std::pair<int, int> sensor_size() const;
 
-    inline int stride() const { return width() * bytes_per_pixel(); }
+    // For NV12 and I420 these describe the Y plane, the chroma planes
+    // follow it; see frame_size().
+    inline int stride() const { return std::max(stride_, width() * bytes_per_pixel()); }
     int bytes_per_pixel() const;
+    // Bytes between the starts of output rows, e.g. a multiple of 64 for
+    // aligned rows or a texture's pitch. Smaller values, like the default
+    // 0, pack the rows. Before start() when using a frame callback.
+    void set_stride(int bytes) { stride_ = bytes; }
+    // Bytes get_frame() writes in the output format.
+    int frame_size() const;
 
     camera(const camera&) = delete;
     void operator=(const camera&) = delete;
@@ -107,7 +288,7 @@ struct camera
     static int normalize_framerate(int fps, resolution res);
     int normalize_framerate(int fps);
 
-    constexpr int error_code() const { return error_code_; }
+    int error_code() const { return error_code_; }
     const char* error_string() const;
 
     static constexpr int NO_ERROR = 0;
@@ -127,12 +308,22 @@ private:
     bool sccb_check_status();
     void sccb_reg_write(uint8_t reg, uint8_t val);
     uint8_t sccb_reg_read(uint16_t reg);
+    // As the above, from the shadow if the register was written since
+    // the last reset.
+    uint8_t ov534_reg_cached(uint16_t reg);
+    uint8_t sccb_reg_cached(uint8_t reg);
+    void ov534_reg_write_array(const uint8_t (*data)[2], int len);
     void reg_w_array(const uint8_t (*data)[2], int len);
     void sccb_w_array(const uint8_t (*data)[2], int len);
 
     void set_error(int code);
+    static void deliver_frames(void* data);
+    ps3eye::detail::frame_output output(const frame_roi* rois = nullptr, unsigned count = 0) const;
+    static int apply_control(void* data, control c, int value);
+    ps3eye::detail::control_queue& controls();
 
-    int error_code_ = NO_ERROR;
+    // also read by the delivery and control threads
+    std::atomic<int> error_code_ = NO_ERROR;
 
     template<uint8_t min = 0, uint8_t max = 255> using val = ps3eye::detail::val_<uint8_t, min, max>;
     template<int8_t min, uint8_t max> using val_ = ps3eye::detail::val_<int8_t, min, max>;
@@ -155,6 +346,8 @@ private:
     bool flip_v_ = false;
     bool test_pattern_ = false;
     bool streaming_ = false;
+    bool fast_init_ = true;
+    ps3eye::startup_timing timing_;
 
     //static bool enumerated;
     //static std::vector<std::shared_ptr<camera>> devices;
@@ -162,14 +355,43 @@ private:
     resolution resolution_ = res_VGA;
     int framerate_ = 30;
     format format_ = format::BGR;
+    output_scale scale_ = output_scale::full;
+    demosaic demosaic_ = demosaic::bilinear;
+    int stride_ = 0;
+    std::string recording_path_;
+    int queue_depth_ = ps3eye::detail::frame_queue::default_depth;
+    uint8_t* frame_memory_ = nullptr;
+    size_t frame_memory_size_ = 0;
+    drop_policy drop_policy_ = drop_policy::drop_newest;
+    frame_callback frame_callback_;
+    int transfer_count_ = 5;
+    int transfer_size_ = (int)ps3eye::detail::urb_descriptor::default_transfer_size;
+
+    // the callback of the current stream and where it gets its frames
+    frame_callback delivering_;
+    std::vector<uint8_t> delivery_frame_;
+    bool delivery_stopped_ = false;
+    ps3eye::detail::delivery_task delivery_ { &camera::deliver_frames, this };
 
     // usb stuff
-    libusb_device* device_ = nullptr;
-    libusb_device_handle* handle_ = nullptr;
+    std::unique_ptr<ps3eye::detail::transport> transport_;
+    bool is_open_usb_ = false;
+    ps3eye::detail::register_shadow bridge_shadow_, sensor_shadow_;
+
+    // Held while talking to the camera, so that controls set from other
+    // threads don't interleave their register accesses.
+    mutable std::recursive_mutex control_mutex_;
+    std::once_flag controls_once_;
+    std::unique_ptr<ps3eye::detail::control_queue> controls_;
     ps3eye::detail::urb_descriptor urb;
-    std::array<uint8_t, 64> usb_buf;
 };
 
 std::vector<std::shared_ptr<camera>> list_devices();
 
+// A camera that plays back a capture file instead of talking to hardware.
+// Register reads and writes go to a model of the bridge and sensor, so
+// init() and the controls work as usual. The resolution passed to init()
+// has to match the recording.
+std::shared_ptr<camera> open_replay(const char* path, replay_rate rate = replay_rate::recorded, bool loop = false);
+
 } // namespace ps3eye
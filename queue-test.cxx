@@ -0,0 +1,151 @@
+#include "queue.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using ps3eye::detail::frame_queue;
+using ps3eye::drop_policy;
+
+// Hammer the frame ring from a producer and a consumer thread. Every frame
+// is filled with one byte value and starts with its number, so a torn or
+// reordered frame shows up on the consumer side.
+
+static constexpr int W = 320, H = 240;
+static constexpr unsigned num_frames = 200000;
+
+static void fill(uint8_t* frame, uint32_t n)
+{
+    memset(frame, (uint8_t)n, W * H);
+    memcpy(frame, &n, sizeof(n));
+}
+
+static bool check(const uint8_t* frame, uint32_t& last, const char* how)
+{
+    uint32_t n;
+    memcpy(&n, frame, sizeof(n));
+
+    if (last != UINT32_MAX && n <= last)
+    {
+        fprintf(stderr, "[FAIL] %s: frame %u after %u\n", how, n, last);
+        return false;
+    }
+    for (unsigned i = sizeof(n); i < W * H; i++)
+        if (frame[i] != (uint8_t)n)
+        {
+            fprintf(stderr, "[FAIL] %s: frame %u torn at byte %u\n", how, n, i);
+            return false;
+        }
+
+    last = n;
+    return true;
+}
+
+static const char* const policy_names[] = { "drop_newest", "drop_oldest", "latest_only", "never_drop" };
+
+static bool run(unsigned depth, drop_policy policy)
+{
+    auto queue = std::make_unique<frame_queue>();
+    if (!queue->reserve(W * H, depth))
+    {
+        fprintf(stderr, "[FAIL] can't allocate %u frames\n", depth);
+        return false;
+    }
+    queue->set_drop_policy(policy);
+    queue->init(W * H);
+
+    std::atomic_bool done = false;
+
+    std::thread producer([&] {
+        uint8_t* frame = queue->buffer();
+        for (uint32_t n = 0; n < num_frames; n++)
+        {
+            fill(frame, n);
+            ps3eye::frame_metadata meta;
+            meta.timestamp = meta.first_payload = std::chrono::steady_clock::now();
+            meta.pts = n;
+            frame = queue->enqueue(meta);
+            // let the consumer catch up now and then, so both the
+            // empty and the full ring get exercised
+            if (n % 64 == 0)
+                std::this_thread::yield();
+        }
+        done = true;
+    });
+
+    std::vector<uint8_t> buf(W * H);
+    uint32_t last = UINT32_MAX;
+    uint64_t last_sequence = 0;
+    unsigned received = 0;
+    bool status = true;
+
+    while (status)
+    {
+        ps3eye::frame_metadata meta;
+
+        if (received % 2)
+        {
+            const uint8_t* data = queue->acquire(meta);
+            if (!data)
+            {
+                if (done)
+                    break;
+                continue;
+            }
+            status &= check(data, last, "acquire");
+            queue->release();
+        }
+        else
+        {
+            if (!queue->dequeue(buf.data(), W, H, ps3eye::detail::frame_output{ ps3eye::format::Bayer, W }, &meta))
+            {
+                if (done)
+                    break;
+                continue;
+            }
+            status &= check(buf.data(), last, "dequeue");
+        }
+
+        if (received && (meta.sequence <= last_sequence ||
+                         (policy == drop_policy::never_drop && meta.sequence != last_sequence + 1)))
+        {
+            fprintf(stderr, "[FAIL] sequence %u after %u\n", (unsigned)meta.sequence, (unsigned)last_sequence);
+            status = false;
+        }
+        last_sequence = meta.sequence;
+        received++;
+    }
+
+    producer.join();
+
+    ps3eye::capture_stats stats = queue->counters().snapshot();
+    if (stats.frames_completed != num_frames || stats.frames_delivered != received ||
+        stats.frames_delivered + stats.frames_dropped != num_frames || stats.policy != policy)
+    {
+        fprintf(stderr, "[FAIL] stats: %u completed, %u delivered, %u overwritten, %u evicted, %u skipped\n",
+                (unsigned)stats.frames_completed, (unsigned)stats.frames_delivered,
+                (unsigned)stats.frames_overwritten, (unsigned)stats.frames_evicted,
+                (unsigned)stats.frames_skipped);
+        status = false;
+    }
+
+    printf("[%s] depth %u, %s: %u of %u frames received\n", status ? "GOOD" : "FAIL",
+           depth, policy_names[(int)policy], received, num_frames);
+
+    return status;
+}
+
+int main(void)
+{
+    bool status = true;
+    for (unsigned depth : { frame_queue::min_depth, frame_queue::default_depth, 8u })
+        for (drop_policy policy : { drop_policy::drop_newest, drop_policy::drop_oldest,
+                                    drop_policy::latest_only, drop_policy::never_drop })
+            status &= run(depth, policy);
+
+    return status ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,351 +1,529 @@
 #undef NDEBUG
 #include "queue.hpp"
+#include "debayer.hpp"
+#include "futex.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cassert>
 
 namespace ps3eye::detail {
 
+bool frame_queue::reserve(unsigned frame_size, unsigned depth, uint8_t* memory, size_t memory_size)
+{
+    depth = std::clamp(depth, min_depth, max_depth);
+    const size_t needed = size_t(frame_size) * depth;
+
+    if (memory)
+    {
+        if (memory_size < needed)
+        {
+            ps3eye_debug("frame memory too small, %u bytes for %u bytes\n", (unsigned)memory_size, (unsigned)needed);
+            return false;
+        }
+        storage_.free();
+        buffer_ = memory;
+        capacity_ = memory_size;
+    }
+    else if (buffer_ != storage_.data() || storage_.size() < needed || storage_.size() / 2 > needed)
+    {
+        buffer_ = nullptr;
+        capacity_ = 0;
+        if (!storage_.allocate(needed))
+            return false;
+        buffer_ = storage_.data();
+        capacity_ = storage_.size();
+    }
+
+    depth_ = depth;
+    counter_period_ = (1u << 31) / depth * depth;
+    metadata_.resize(depth);
+
+    return true;
+}
+
 void frame_queue::init(unsigned frame_size)
 {
+    if (!buffer_ || size_t(frame_size) * depth_ > capacity_)
+    {
+        bool ok = reserve(frame_size, depth_ ? depth_ : default_depth);
+        assert(ok && "can't allocate the frame ring");
+    }
+
     size_ = frame_size;
     head_ = 0;
     tail_ = 0;
-    available_ = 0;
+    sequence_ = 0;
+    leased_ = false;
+    shutdown_ = false;
+    armed_ = true;
+    counters_.reset();
 }
 
 frame_queue::frame_queue() = default;
 
-uint8_t* frame_queue::enqueue()
+uint8_t* frame_queue::enqueue(const frame_metadata& meta)
 {
+    using namespace std::chrono;
+    using clock = steady_clock;
+
     assert(size_ != UINT_MAX);
 
-    uint8_t* new_frame = nullptr;
-    std::lock_guard<std::mutex> lock(mutex_);
-
-    // Unlike traditional producer/consumer, we don't block the producer if
-    // the buffer is full (ie. the consumer is not reading data fast
-    // enough). Instead, if the buffer is full, we simply return the current
-    // frame pointer, causing the producer to overwrite the previous frame.
-    // This allows performance to degrade gracefully: if the consumer is not
-    // fast enough (< Camera FPS), it will miss frames, but if it is fast
-    // enough (>= Camera FPS), it will see everything.
-    //
-    // Note that because the the producer is writing directly to the ring
-    // buffer, we can only ever be a maximum of num_frames-1 ahead of the
-    // consumer, otherwise the producer could overwrite the frame the
-    // consumer is currently reading (in case of a slow consumer)
-    if (available_ >= max_buffered_frames - 1)
+    // This runs on the USB thread. Only the producer stores head_; tail_
+    // belongs to the consumer, except that the producer may push it past
+    // a frame the consumer isn't reading to evict it. Both count frames
+    // and are reduced modulo the ring size on use.
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    const unsigned slot = head % depth_;
+
+    // Stamp the frame just completed. If it's about to be overwritten
+    // below, the gap in sequence numbers tells the consumer.
+    metadata_[slot] = meta;
+    metadata_[slot].sequence = sequence_++;
+    capture_counters::bump(counters_.frames_completed);
+
+    // Because the producer writes directly to the ring buffer, it can only
+    // ever be depth-1 frames ahead of the consumer, otherwise it could
+    // overwrite the frame the consumer is reading. When it's that far
+    // ahead, the policy decides which frame goes.
+    uint32_t tail = tail_.load(std::memory_order_acquire);
+    clock::time_point deadline;
+    bool stalled = false;
+
+    while (distance(head, tail & ~busy_bit) >= depth_ - 1)
     {
-        return buffer_.data() + head_ * size_;
+        switch (policy_)
+        {
+        case drop_policy::drop_oldest:
+        case drop_policy::latest_only:
+            // Unless the consumer is reading it, drop the oldest frame and
+            // reuse its slot for the next one.
+            if (!(tail & busy_bit))
+            {
+                if (tail_.compare_exchange_weak(tail, next(tail), std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    capture_counters::bump(counters_.frames_evicted);
+                    goto publish;
+                }
+                continue;
+            }
+            break;
+        case drop_policy::never_drop:
+        {
+            // Wait for the consumer. This holds up the USB thread and all
+            // cameras on it, so give up eventually or when stopping.
+            auto now = clock::now();
+            if (!stalled)
+            {
+                capture_counters::bump(counters_.producer_stalls);
+                deadline = now + max_producer_stall;
+                stalled = true;
+            }
+            auto left = duration_cast<microseconds>(deadline - now);
+            if (left <= 0us || shutdown_.load(std::memory_order_relaxed))
+                break;
+
+            // Same handshake as wait_for_frame(), the other way around.
+            producer_waiting_.store(true, std::memory_order_seq_cst);
+            if (tail_.load(std::memory_order_seq_cst) == tail)
+                futex_wait(tail_, tail, left);
+            producer_waiting_.store(false, std::memory_order_relaxed);
+            tail = tail_.load(std::memory_order_acquire);
+            continue;
+        }
+        case drop_policy::drop_newest:
+            break;
+        }
+
+        // Overwrite the frame just completed instead. A consumer slower
+        // than the camera misses frames; one that keeps up sees them all.
+        capture_counters::bump(counters_.frames_overwritten);
+        return buffer_ + slot * size_;
     }
 
+publish:
     // Note: we don't need to copy any data to the buffer since the USB
-    // packets are directly written to the frame buffer. We just need to
-    // update head and available count to signal to the consumer that a new
-    // frame is available
-    head_ = (head_ + 1) % max_buffered_frames;
-    available_ = std::min(available_ + 1, max_buffered_frames);
+    // packets are directly written to the frame buffer. Publishing the new
+    // head hands the frame and its metadata over to the consumer.
+    head_.store(next(head), std::memory_order_seq_cst);
+
+    // Only make the syscall if the consumer is asleep. Pairs with the
+    // store to waiting_ in wait_for_frame().
+    if (waiting_.load(std::memory_order_seq_cst))
+        futex_wake_all(head_);
+    // Likewise for pollers, pairs with the store in wait_for_frame().
+    if (armed_.load(std::memory_order_seq_cst) && armed_.exchange(false, std::memory_order_seq_cst))
+    {
+        notifier_.notify();
+        if (hook_)
+            hook_(hook_data_);
+    }
 
     // Determine the next frame pointer that the producer should write to
-    new_frame = buffer_.data() + head_ * size_;
+    return buffer_ + next(head) % depth_ * size_;
+}
 
-    // Signal consumer that data became available
-    notify_frame_.notify_one();
+void frame_queue::set_drop_policy(drop_policy policy)
+{
+    policy_ = policy;
+    counters_.policy = policy;
+}
 
-    return new_frame;
+void frame_queue::shutdown()
+{
+    shutdown_.store(true, std::memory_order_seq_cst);
+    futex_wake_all(tail_);
 }
 
-static void debayer_gray(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf)
+int bytes_per_pixel(format fmt)
 {
-    // PSMove output is in the following Bayer format (GRBG):
-    //
-    // G R G R G R
-    // B G B G B G
-    // G R G R G R
-    // B G B G B G
-    //
-    // This is the normal Bayer pattern shifted left one place.
-
-    int source_stride = W;
-    const uint8_t* source_row = input; // Start at first bayer pixel
-    int dest_stride = W;
-    uint8_t* dest_row = buf + dest_stride + 1; // We start outputting
-    // at the second pixel
-    // of the second row's
-    // G component
-    uint32_t R, G, B;
-
-    // Fill rows 1 to height-2 of the destination buffer. First and last row
-    // are filled separately (they are copied from the second row and
-    // second-to-last rows respectively)
-    for (int y = 0; y < H - 2;
-         source_row += source_stride, dest_row += dest_stride, ++y)
+    switch (fmt)
     {
-        const uint8_t* source = source_row;
-        // -2 to deal with the fact that we're starting at the second pixel of
-        // the row and should end at the second-to-last pixel of the row
-        // (first and last are filled separately)
-        const uint8_t* source_end =
-            source + (source_stride - 2);
-        uint8_t* dest = dest_row;
-
-        // Row starting with Green
-        if (y % 2 == 0)
-        {
-            // Fill first pixel (green)
-            B = (source[source_stride] + source[source_stride + 2] + 1) >> 1;
-            G = source[source_stride + 1];
-            R = (source[1] + source[source_stride * 2 + 1] + 1) >> 1;
-            *dest = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+    case format::Bayer:
+    case format::Gray:
+    case format::NV12:
+    case format::I420:
+        return 1;
+    case format::YUYV:
+        return 2;
+    case format::BGR:
+    case format::RGB:
+        return 3;
+    case format::BGRA:
+    case format::RGBA:
+        return 4;
+    }
+    return 0;
+}
 
-            source++;
-            dest++;
+void frame_queue::convert(const uint8_t* source, uint8_t* dest, int W, int H, const frame_output& out)
+{
+    // on the consumer thread, between runs
+    pool_.set_threads(debayer_threads());
 
-            // Fill remaining pixel
-            for (; source <= source_end - 2; source += 2, dest += 2)
-            {
-                // Blue pixel
-                B = source[source_stride + 1];
-                G = (source[1] + source[source_stride] + source[source_stride + 2] +
-                     source[source_stride * 2 + 1] + 2) >> 2;
-                R = (source[0] + source[2] + source[source_stride * 2] +
-                     source[source_stride * 2 + 2] + 2) >> 2;
-                dest[0] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
-
-                //  Green pixel
-                B = (source[source_stride + 1] + source[source_stride + 3] + 1) >> 1;
-                G = source[source_stride + 2];
-                R = (source[2] + source[source_stride * 2 + 2] + 1) >> 1;
-                dest[1] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
-            }
-        }
+    if (out.roi_count > 0)
+    {
+        convert_rois(source, dest, W, H, out);
+        return;
+    }
+    if (out.scale == output_scale::half)
+    {
+        convert_binned(source, dest, W, H, out);
+        return;
+    }
+
+    const debayer_impl& debayer = debayer_best();
+    const bool malvar = out.method == demosaic::malvar;
+    const int stride = out.stride;
+    debayer_fn fn;
+
+    switch (out.fmt)
+    {
+    case format::Bayer:
+        if (stride == W)
+            memcpy(dest, source, unsigned(W * H));
         else
-        {
-            for (; source <= source_end - 2; source += 2, dest += 2)
-            {
-                // Red pixel
-                B = (source[0] + source[2] + source[source_stride * 2] +
-                     source[source_stride * 2 + 2] + 2) >> 2;
+            for (int y = 0; y < H; y++)
+                memcpy(dest + y * stride, source + y * W, unsigned(W));
+        return;
+    case format::BGR:
+        fn = malvar ? debayer.malvar.bgr : debayer.bgr;
+        break;
+    case format::RGB:
+        fn = malvar ? debayer.malvar.rgb : debayer.rgb;
+        break;
+    case format::BGRA:
+        fn = malvar ? debayer.malvar.bgra : debayer.bgra;
+        break;
+    case format::RGBA:
+        fn = malvar ? debayer.malvar.rgba : debayer.rgba;
+        break;
+    case format::Gray:
+        fn = debayer.gray;
+        break;
+    case format::NV12:
+        fn = debayer.nv12;
+        break;
+    case format::I420:
+        fn = debayer.i420;
+        break;
+    case format::YUYV:
+        fn = debayer.yuyv;
+        break;
+    default:
+        ps3eye_debug("invalid format %d in dequeue()\n", (int)out.fmt);
+        return;
+    }
 
-                G = (source[1] + source[source_stride] + source[source_stride + 2] +
-                     source[source_stride * 2 + 1] + 2) >> 2;
+    // Split the rows between the pool's threads. The kernels produce the
+    // same output no matter where the bands start and end, so long as the
+    // 4:2:0 ones get whole row pairs: seams between bands are on even rows.
+    const unsigned bands = pool_.threads();
+    const int rows = H - 2;
+    auto seam = [&](unsigned i) {
+        if (i == 0 || i == bands)
+            return 1 + int(rows * i / bands);
+        return std::max(2, (1 + int(rows * i / bands)) & ~1);
+    };
+
+    pool_.run(bands, [&](unsigned i) {
+        int y0 = seam(i), y1 = seam(i + 1);
+        if (y0 < y1)
+            fn(W, H, source, dest, stride, y0, y1);
+    });
+}
 
-                R = source[source_stride + 1];
-                dest[0] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+void frame_queue::convert_binned(const uint8_t* source, uint8_t* dest, int W, int H, const frame_output& out)
+{
+    const auto& binned = debayer_best().binned;
+    debayer_fn fn;
 
-                // Green pixel
-                B = (source[2] + source[source_stride * 2 + 2] + 1) >> 1;
-                G = source[source_stride + 2];
-                R = (source[source_stride + 1] + source[source_stride + 3] + 1) >> 1;
-                dest[1] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
-            }
+    switch (out.fmt)
+    {
+    case format::BGR:
+        fn = binned.bgr;
+        break;
+    case format::RGB:
+        fn = binned.rgb;
+        break;
+    case format::BGRA:
+        fn = binned.bgra;
+        break;
+    case format::RGBA:
+        fn = binned.rgba;
+        break;
+    case format::Gray:
+        fn = binned.gray;
+        break;
+    default:
+        ps3eye_debug("format %d can't be binned\n", (int)out.fmt);
+        return;
+    }
+
+    const unsigned bands = pool_.threads();
+    const int rows = H / 2;
+
+    pool_.run(bands, [&](unsigned i) {
+        int y0 = int(rows * i / bands), y1 = int(rows * (i + 1) / bands);
+        if (y0 < y1)
+            fn(W, H, source, dest, out.stride, y0, y1);
+    });
+}
+
+// Each region is converted from a window of the Bayer frame that starts
+// on a G R row at a G pixel, so the window has the frame's Bayer phase.
+// Where the region isn't at the frame's border the window extends past it
+// as far as the kernel looks, a pixel, or two for demosaic::malvar, so the
+// region's pixels see their real neighbors and come out as a full
+// conversion would make them. Binned pixels have no neighbors to speak of.
+void frame_queue::convert_rois(const uint8_t* source, uint8_t* dest, int W, int H, const frame_output& out)
+{
+    const bool binned = out.scale == output_scale::half;
+    const int bpp = bytes_per_pixel(out.fmt);
+    const int out_w = binned ? W / 2 : W, out_h = binned ? H / 2 : H;
+    const int reach = out.method == demosaic::malvar ? 2 : 1;
+
+    if (out.fmt == format::NV12 || out.fmt == format::I420)
+    {
+        // chroma rows would need regions of their own
+        frame_output whole = out;
+        whole.roi_count = 0;
+        convert(source, dest, W, H, whole);
+        return;
+    }
+
+    for (unsigned i = 0; i < out.roi_count; i++)
+    {
+        const frame_roi& roi = out.rois[i];
+        int x0 = std::max(roi.x, 0), x1 = std::min(roi.x + roi.width, out_w);
+        int y0 = std::max(roi.y, 0), y1 = std::min(roi.y + roi.height, out_h);
+        if (out.fmt == format::YUYV)
+            x0 &= ~1, x1 += x1 & 1;
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+
+        // the Bayer window, in pixels of the frame
+        int wx0, wx1, wy0, wy1;
+        if (binned)
+            wx0 = x0 * 2, wx1 = x1 * 2, wy0 = y0 * 2, wy1 = y1 * 2;
+        else
+        {
+            wx0 = std::max(x0 - reach, 0) & ~1, wx1 = std::min(x1 + reach + (x1 + reach) % 2, W);
+            wy0 = std::max(y0 - reach, 0) & ~1, wy1 = std::min(y1 + reach + (y1 + reach) % 2, H);
+            // the kernels want a few pixels each way
+            wx1 = std::min(std::max(wx1, wx0 + 4), W), wx0 = std::max(std::min(wx0, wx1 - 4), 0);
+            wy1 = std::min(std::max(wy1, wy0 + 4), H), wy0 = std::max(std::min(wy0, wy1 - 4), 0);
         }
+        const int ww = wx1 - wx0, wh = wy1 - wy0;
 
-        if (source < source_end)
+        if (out.fmt == format::Bayer)
         {
-            B = source[source_stride + 1];
-            G = (source[1] + source[source_stride] + source[source_stride + 2] +
-                 source[source_stride * 2 + 1] + 2) >> 2;
-            R = (source[0] + source[2] + source[source_stride * 2] +
-                 source[source_stride * 2 + 2] + 2) >> 2;
+            for (int y = y0; y < y1; y++)
+                memcpy(dest + y * out.stride + x0, source + y * W + x0, unsigned(x1 - x0));
+            continue;
+        }
+
+        roi_input_.resize(unsigned(ww * wh));
+        for (int y = 0; y < wh; y++)
+            memcpy(&roi_input_[unsigned(y * ww)], source + (wy0 + y) * W + wx0, unsigned(ww));
 
-            dest[0] = (uint8_t)((R * 77 + G * 151 + B * 28) >> 8);
+        frame_output window = out;
+        window.roi_count = 0;
 
-            //source++;
-            //dest++;
+        if (binned)
+        {
+            // straight into place
+            window.stride = out.stride;
+            convert(roi_input_.data(), dest + y0 * out.stride + x0 * bpp, ww, wh, window);
+            continue;
         }
 
-        // Fill first pixel of row (copy second pixel)
-        uint8_t* first_pixel = dest_row - 1;
-        first_pixel[0] = dest_row[0];
+        window.stride = ww * bpp;
+        roi_output_.resize(unsigned(ww * wh * bpp));
+        convert(roi_input_.data(), roi_output_.data(), ww, wh, window);
 
-        // Fill last pixel of row (copy second-to-last pixel). Note: dest row
-        // starts at the *second* pixel of the row, so dest_row + (width-2)
-        // * num_output_channels puts us at the last pixel of the row
-        uint8_t* last_pixel = dest_row + (W - 2);
-        uint8_t* second_to_last_pixel = last_pixel - 1;
-        last_pixel[0] = second_to_last_pixel[0];
+        for (int y = y0; y < y1; y++)
+            memcpy(dest + y * out.stride + x0 * bpp,
+                   &roi_output_[unsigned((y - wy0) * window.stride + (x0 - wx0) * bpp)],
+                   unsigned((x1 - x0) * bpp));
     }
+}
 
-    // Fill first & last row
-    for (int i = 0; i < dest_stride; i++)
+bool frame_queue::dequeue(uint8_t* dest, int W, int H, const frame_output& out, frame_metadata* meta,
+                          std::chrono::microseconds timeout)
+{
+    assert(size_ != UINT_MAX);
+
+    // There's nothing else to hand out until the lease is released.
+    uint32_t tail;
+    if (leased_ || !claim(tail, timeout))
+        return false;
+
+    const unsigned slot = tail % depth_;
+
+    // Copy from internal buffer
+    convert(buffer_ + size_ * slot, dest, W, H, out);
+    if (meta)
+        *meta = metadata_[slot];
+
+    finish(tail);
+    capture_counters::bump(counters_.frames_delivered);
+
+    return true;
+}
+
+bool frame_queue::wait_for_frame(std::chrono::microseconds timeout)
+{
+    using namespace std::chrono_literals;
+    using clock = std::chrono::steady_clock;
+
+    if (timeout <= 0us)
     {
-        buf[i] = buf[i + dest_stride];
-        buf[i + (H - 1) * dest_stride] = buf[i + (H - 2) * dest_stride];
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) != tail)
+            return true;
+        if (!notifier_.is_open() && !hook_)
+            return false;
+
+        // Empty, so have the next frame notify pollers. Then clear the fd
+        // and look again, in case a frame came before it was armed.
+        armed_.store(true, std::memory_order_seq_cst);
+        notifier_.drain();
+        return head_.load(std::memory_order_seq_cst) != tail;
+    }
+
+    const auto deadline = clock::now() + timeout;
+
+    // If there is no data in the buffer, wait until data becomes available
+    for (;;)
+    {
+        // The producer may evict frames meanwhile, but never empties the ring.
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (head_.load(std::memory_order_acquire) != tail)
+            return true;
+
+        auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - clock::now());
+        if (left <= 0us)
+        {
+            capture_counters::bump(counters_.get_frame_timeouts);
+            return false;
+        }
+
+        // Announce ourselves before the last check so that the producer
+        // either sees us waiting or we see its new head. futex_wait()
+        // itself returns at once if the head moved in between.
+        waiting_.store(true, std::memory_order_seq_cst);
+        if (head_.load(std::memory_order_seq_cst) == tail)
+            futex_wait(head_, tail, left);
+        waiting_.store(false, std::memory_order_relaxed);
     }
 }
 
-template<bool in_BGR, int swap_br = in_BGR ? 1 : -1>
-static void debayer_rgb(int W, int H, const uint8_t* __restrict input, uint8_t* __restrict buf)
+bool frame_queue::claim(uint32_t& tail, std::chrono::microseconds timeout)
 {
-    // PSMove output is in the following Bayer format (GRBG):
-    //
-    // G R G R G R
-    // B G B G B G
-    // G R G R G R
-    // B G B G B G
-    //
-    // This is the normal Bayer pattern shifted left one place.
-
-    constexpr int num_output_channels = 3;
-    int source_stride = W;
-    const uint8_t* source_row = input; // Start at first bayer pixel
-    int dest_stride = W * num_output_channels;
-    // We start outputting at the second pixel of the
-    uint8_t* dest_row = buf + dest_stride + num_output_channels + 1;
-    // second row's G component
-
-    // Fill rows 1 to height-2 of the destination buffer. First and last row
-    // are filled separately (they are copied from the second row and
-    // second-to-last rows respectively)
-    for (int y = 0; y < H - 2;
-         source_row += source_stride, dest_row += dest_stride, ++y)
+    for (;;)
     {
-        const uint8_t* source = source_row;
-        // -2 to deal with the fact that we're starting at the second pixel of
-        // the row and should end at the second-to-last pixel of the row
-        // (first and last are filled separately)
-        const uint8_t* source_end = source + (source_stride - 2);
-        uint8_t* dest = dest_row;
-
-        // Row starting with Green
-        if (y % 2 == 0)
-        {
-            // Fill first pixel (green)
-            dest[-1 * swap_br] =
-                (source[source_stride] + source[source_stride + 2] + 1) >> 1;
-            dest[0] = source[source_stride + 1];
-            dest[1 * swap_br] = (source[1] + source[source_stride * 2 + 1] + 1) >> 1;
+        if (!wait_for_frame(timeout))
+            return false;
 
-            source++;
-            dest += num_output_channels;
+        // Mark the tail frame busy so that the producer leaves it alone.
+        // That fails if the producer evicted it in the meantime.
+        tail = tail_.load(std::memory_order_acquire);
+        uint32_t target = tail;
+        uint32_t skipped = 0;
 
-            // Fill remaining pixel
-            for (; source <= source_end - 2; source += 2, dest += num_output_channels * 2)
-            {
-                // Blue pixel
-                uint8_t* cur_pixel = dest;
-                cur_pixel[-1 * swap_br] = source[source_stride + 1];
-                cur_pixel[0] = (source[1] + source[source_stride] +
-                                source[source_stride + 2] +
-                                source[source_stride * 2 + 1] + 2) >> 2;
-                cur_pixel[1 * swap_br] =
-                    (source[0] + source[2] + source[source_stride * 2] +
-                     source[source_stride * 2 + 2] + 2) >> 2;
-
-                //  Green pixel
-                uint8_t* next_pixel = cur_pixel + num_output_channels;
-                next_pixel[-1 * swap_br] =
-                    (source[source_stride + 1] + source[source_stride + 3] + 1) >> 1;
-                next_pixel[0] = source[source_stride + 2];
-                next_pixel[1 * swap_br] =
-                    (source[2] + source[source_stride * 2 + 2] + 1) >> 1;
-            }
-        }
-        else
+        if (policy_ == drop_policy::latest_only)
         {
-            for (; source <= source_end - 2; source += 2, dest += num_output_channels * 2)
-            {
-                // Red pixel
-                uint8_t* cur_pixel = dest;
-                cur_pixel[-1 * swap_br] =
-                    (source[0] + source[2] + source[source_stride * 2] +
-                     source[source_stride * 2 + 2] + 2) >> 2;
-
-                cur_pixel[0] =
-                    (source[1] + source[source_stride] +
-                     source[source_stride + 2] +
-                     source[source_stride * 2 + 1] + 2) >> 2;
-
-                cur_pixel[1 * swap_br] = source[source_stride + 1];
-
-                // Green pixel
-                uint8_t* next_pixel = cur_pixel + num_output_channels;
-                next_pixel[-1 * swap_br] =
-                    (source[2] + source[source_stride * 2 + 2] + 1) >> 1;
-                next_pixel[0] = source[source_stride + 2];
-                next_pixel[1 * swap_br] =
-                    (source[source_stride + 1] + source[source_stride + 3] + 1) >> 1;
-            }
+            const uint32_t head = head_.load(std::memory_order_acquire);
+            skipped = distance(head, tail) - 1;
+            target = (head + counter_period_ - 1) % counter_period_;
         }
 
-        if (source < source_end)
+        if (tail_.compare_exchange_strong(tail, target | busy_bit, std::memory_order_acq_rel, std::memory_order_acquire))
         {
-            dest[-1 * swap_br] = source[source_stride + 1];
-            dest[0] = (source[1] + source[source_stride] + source[source_stride + 2] +
-                       source[source_stride * 2 + 1] + 2) >> 2;
-            dest[1 * swap_br] = (source[0] + source[2] + source[source_stride * 2] +
-                                 source[source_stride * 2 + 2] + 2) >> 2;
-
-            //source++;
-            //dest += num_output_channels;
+            tail = target;
+            if (skipped)
+                capture_counters::bump(counters_.frames_skipped, skipped);
+            return true;
         }
-
-        // Fill first pixel of row (copy second pixel)
-        uint8_t* first_pixel = dest_row - num_output_channels;
-        first_pixel[-1 * swap_br] = dest_row[-1 * swap_br];
-        first_pixel[0] = dest_row[0];
-        first_pixel[1 * swap_br] = dest_row[1 * swap_br];
-
-        // Fill last pixel of row (copy second-to-last pixel). Note: dest row
-        // starts at the *second* pixel of the row, so dest_row + (width-2)
-        // * num_output_channels puts us at the last pixel of the row
-        uint8_t* last_pixel = dest_row + (W - 2) * num_output_channels;
-        uint8_t* second_to_last_pixel = last_pixel - num_output_channels;
-
-        last_pixel[-1 * swap_br] = second_to_last_pixel[-1 * swap_br];
-        last_pixel[0] = second_to_last_pixel[0];
-        last_pixel[1 * swap_br] = second_to_last_pixel[1 * swap_br];
     }
+}
 
-    // Fill first & last row
-    for (int i = 0; i < dest_stride; i++)
-    {
-        buf[i] = buf[i + dest_stride];
-        buf[i + (H - 1) * dest_stride] = buf[i + (H - 2) * dest_stride];
-    }
+void frame_queue::finish(uint32_t tail)
+{
+    // Give the slot back to the producer
+    tail_.store(next(tail), std::memory_order_seq_cst);
+
+    // Pairs with the store to producer_waiting_ in enqueue().
+    if (producer_waiting_.load(std::memory_order_seq_cst))
+        futex_wake_all(tail_);
 }
 
-bool frame_queue::dequeue(uint8_t* dest, int W, int H, format fmt)
+const uint8_t* frame_queue::acquire(frame_metadata& meta, std::chrono::microseconds timeout)
 {
     assert(size_ != UINT_MAX);
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    using namespace std::chrono_literals;
-
-    // If there is no data in the buffer, wait until data becomes available
-    bool status = notify_frame_.wait_for(lock, 50ms, [this]() { return available_ != 0; });
-    if (!status)
-        return false;
+    uint32_t tail;
+    if (leased_ || !claim(tail, timeout))
+        return nullptr;
 
-    // Copy from internal buffer
-    uint8_t* source = buffer_.data() + size_ * tail_;
+    // The busy tail frame stays intact until release().
+    const unsigned slot = tail % depth_;
+    leased_ = true;
+    leased_tail_ = tail;
+    meta = metadata_[slot];
+    capture_counters::bump(counters_.frames_delivered);
 
-    switch (fmt)
-    {
-    case format::Bayer:
-        memcpy(dest, source, size_);
-        break;
-    case format::BGR:
-        debayer_rgb<true>(W, H, source, dest);
-        break;
-    case format::RGB:
-        debayer_rgb<false>(W, H, source, dest);
-        break;
-    case format::Gray:
-        debayer_gray(W, H, source, dest);
-        break;
-    default:
-        ps3eye_debug("invalid format %d in dequeue()\n", (int)fmt);
-        break;
-    }
+    return buffer_ + size_ * slot;
+}
 
-    // Update tail and available count
-    tail_ = (tail_ + 1) % max_buffered_frames;
-    available_--;
+void frame_queue::release()
+{
+    if (!leased_)
+        return;
 
-    return true;
+    leased_ = false;
+    finish(leased_tail_);
 }
 
 } // ns ps3eye::detail
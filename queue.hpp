@@ -1,39 +1,160 @@
 #pragma once
 
 #include "internal.hpp"
+#include "memory.hpp"
+#include "notifier.hpp"
+#include "pool.hpp"
+#include "stats.hpp"
+#include <algorithm>
 #include <climits>
 
+#include <chrono>
 #include <cstdint>
-#include <mutex>
-#include <condition_variable>
-#include <array>
+#include <atomic>
 #include <cstring>
+#include <vector>
 
 namespace ps3eye::detail {
 
+// How dequeue() and convert() write a frame out.
+struct frame_output
+{
+    format fmt = format::Bayer;
+    // Bytes between output rows, see debayer_fn.
+    int stride = 0;
+    // With output_scale::half the output is W/2 x H/2.
+    output_scale scale = output_scale::full;
+    // Frames that aren't binned.
+    demosaic method = demosaic::bilinear;
+    // Only write these rectangles, if any, leaving the rest of the
+    // output alone. See camera::get_frame().
+    const frame_roi* rois = nullptr;
+    unsigned roi_count = 0;
+};
+
+// Bytes per pixel of the format, of the Y plane for NV12 and I420.
+int bytes_per_pixel(format fmt);
+
+// Single-producer, single-consumer frame ring. enqueue() is called by the
+// USB thread only, everything else by the thread reading frames. Neither
+// side takes a lock. What happens to frames the consumer doesn't pick up
+// in time is up to the drop_policy.
 struct frame_queue final
 {
     explicit frame_queue();
+
+    static constexpr unsigned default_depth = 5, min_depth = 2, max_depth = 64;
+
+    // Size the ring for `depth` frames, in `memory` if given or else in
+    // memory of its own, which is kept for later calls if it's big enough.
+    // False if `memory_size` is too small or allocating failed.
+    [[nodiscard]]
+    bool reserve(unsigned frame_size, unsigned depth = default_depth,
+                 uint8_t* memory = nullptr, size_t memory_size = 0);
+    // Empty the ring for a new stream, reserve()'ing it if needed.
     void init(unsigned frame_size);
 
-    uint8_t* buffer() { return buffer_.data(); }
-    uint8_t* enqueue();
+    uint8_t* buffer() { return buffer_; }
+    unsigned depth() const { return depth_; }
+
+    // Only while no frames are enqueued.
+    void set_drop_policy(drop_policy policy);
+    drop_policy policy() const { return policy_; }
+    // Stop a never_drop producer from waiting for the consumer.
+    void shutdown();
+    // Publish the frame just written and get the buffer for the next one.
+    // The sequence number is assigned here.
+    uint8_t* enqueue(const frame_metadata& meta);
+
+    // How long dequeue() and acquire() wait for a frame by default. Zero
+    // doesn't wait at all.
+    static constexpr std::chrono::microseconds default_timeout = std::chrono::milliseconds(50);
+
+    // W and H are the size of the Bayer frames.
+    [[nodiscard]]
+    bool dequeue(uint8_t* dest, int W, int H, const frame_output& out, frame_metadata* meta = nullptr,
+                 std::chrono::microseconds timeout = default_timeout);
 
+    // Hand out the oldest frame in place, without copying. No other frame
+    // can be dequeued or acquired until it's released.
     [[nodiscard]]
-    bool dequeue(uint8_t* dest, int W, int H, format fmt);
+    const uint8_t* acquire(frame_metadata& meta, std::chrono::microseconds timeout = default_timeout);
+    void release();
+    bool leased() const { return leased_; }
+
+    // Readable while a frame may be waiting; a dequeue() or acquire()
+    // without timeout that finds none makes it unreadable again. -1 where
+    // there's no such thing.
+    int poll_fd() { return notifier_.open(); }
+
+    // Have the USB thread call fn(data) on the same occasions as it makes
+    // poll_fd() readable. Only while not streaming.
+    using frame_hook = void(*)(void* data);
+    void set_frame_hook(frame_hook fn, void* data) { hook_ = fn; hook_data_ = data; }
+    unsigned frame_size() const { return size_; }
+
+    // Shared with the USB side, reset by init().
+    capture_counters& counters() { return counters_; }
+
+    // Number of threads debayering a frame in dequeue(), including the
+    // caller's. Any thread; the consumer resizes the pool at its next
+    // convert(), never while one runs.
+    void set_debayer_threads(unsigned n) { debayer_threads_.store(std::max(n, 1u), std::memory_order_relaxed); }
+    unsigned debayer_threads() const { return debayer_threads_.load(std::memory_order_relaxed); }
+
+    // Convert a frame in Bayer format, e.g. an acquired one, using the
+    // debayer threads. Call from the consumer thread.
+    void convert(const uint8_t* source, uint8_t* dest, int W, int H, const frame_output& out);
 
 private:
-    static constexpr unsigned max_frame_size = 640*480;
-    static constexpr unsigned max_buffered_frames = 5;
+    void convert_binned(const uint8_t* source, uint8_t* dest, int W, int H, const frame_output& out);
+    void convert_rois(const uint8_t* source, uint8_t* dest, int W, int H, const frame_output& out);
+    bool wait_for_frame(std::chrono::microseconds timeout);
+    // Take the tail frame, or the newest one with latest_only, for reading.
+    bool claim(uint32_t& tail, std::chrono::microseconds timeout);
+    void finish(uint32_t tail);
+
+    // Set in tail_ while the consumer reads the tail frame.
+    static constexpr uint32_t busy_bit = 1u << 31;
+    static constexpr auto max_producer_stall = std::chrono::milliseconds(500);
+
+    uint32_t next(uint32_t x) const { return (x + 1) % counter_period_; }
+    uint32_t distance(uint32_t head, uint32_t tail) const { return (head - tail + counter_period_) % counter_period_; }
 
-    std::mutex mutex_;
-    std::condition_variable notify_frame_;
-    std::array<uint8_t, max_frame_size * max_buffered_frames> buffer_;
+    page_buffer storage_;
+    uint8_t* buffer_ = nullptr;
+    size_t capacity_ = 0;
+    std::vector<frame_metadata> metadata_;
+    worker_pool pool_;
+    std::atomic<unsigned> debayer_threads_ = 1;
+    capture_counters counters_;
+    // Bayer and converted windows around a region of interest
+    std::vector<uint8_t> roi_input_, roi_output_;
 
     unsigned size_ = UINT_MAX;
-    unsigned head_ = 0;
-    unsigned tail_ = 0;
-    unsigned available_ = 0;
+    unsigned depth_ = 0;
+    // Frame counters wrap at a multiple of the ring size so that the slot
+    // index stays continuous across the wrap.
+    uint32_t counter_period_ = 0;
+    drop_policy policy_ = drop_policy::drop_newest;
+
+    // Producer side
+    alignas(64) std::atomic<uint32_t> head_ = 0;
+    uint64_t sequence_ = 0;
+    std::atomic_bool producer_waiting_ = false;
+    std::atomic_bool shutdown_ = false;
+
+    // Consumer side
+    alignas(64) std::atomic<uint32_t> tail_ = 0;
+    std::atomic_bool waiting_ = false;
+    // The consumer is about to find the ring empty, so the next frame
+    // has to make poll_fd() readable and call the hook.
+    std::atomic_bool armed_ = true;
+    poll_notifier notifier_;
+    frame_hook hook_ = nullptr;
+    void* hook_data_ = nullptr;
+    bool leased_ = false;
+    uint32_t leased_tail_ = 0;
 };
 
 } // ns ps3eye::detail
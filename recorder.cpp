@@ -0,0 +1,145 @@
+#include "recorder.hpp"
+#include "replay.hpp"
+
+#include <cstring>
+
+namespace ps3eye::detail {
+
+capture_recorder::~capture_recorder()
+{
+    close();
+}
+
+bool capture_recorder::open(const char* path, uint32_t frame_size)
+{
+    close();
+
+    file_ = fopen(path, "wb");
+    if (!file_)
+    {
+        ps3eye_debug("recorder: can't create %s\n", path);
+        return false;
+    }
+
+    if (!capture_file::write_header(file_, frame_size))
+    {
+        ps3eye_debug("recorder: can't write to %s\n", path);
+        fclose(file_);
+        file_ = nullptr;
+        return false;
+    }
+
+    for (std::vector<uint8_t>& buf : buffers_)
+    {
+        buf.clear();
+        buf.reserve(buffer_size);
+    }
+    front_ = 0;
+    back_full_ = false;
+    exit_signaled_ = false;
+    write_error_ = false;
+
+    thread_ = std::thread(&capture_recorder::run, this);
+
+    return true;
+}
+
+void capture_recorder::close()
+{
+    if (!file_)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        exit_signaled_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+
+    fclose(file_);
+    file_ = nullptr;
+}
+
+bool capture_recorder::append(std::chrono::steady_clock::time_point received, const uint8_t* data, int len)
+{
+    using namespace std::chrono;
+
+    const uint64_t timestamp_ns = (uint64_t)duration_cast<nanoseconds>(received.time_since_epoch()).count();
+    const uint32_t length = (uint32_t)len;
+    const size_t record_size = capture_file::record_header_size + length;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if (write_error_ || record_size > buffer_size)
+        return false;
+
+    if (buffers_[front_].size() + record_size > buffer_size)
+    {
+        // the writer is still busy with the other one
+        if (back_full_)
+            return false;
+        front_ ^= 1;
+        back_full_ = true;
+        cv_.notify_one();
+    }
+
+    // Only this thread touches the front buffer, but the writer may swap
+    // it on a timeout, so stay under the lock. It's a memcpy.
+    std::vector<uint8_t>& buf = buffers_[front_];
+    size_t pos = buf.size();
+    buf.resize(pos + record_size);
+    memcpy(buf.data() + pos, &timestamp_ns, sizeof(timestamp_ns));
+    memcpy(buf.data() + pos + sizeof(timestamp_ns), &length, sizeof(length));
+    memcpy(buf.data() + pos + capture_file::record_header_size, data, length);
+
+    return true;
+}
+
+bool capture_recorder::write(const std::vector<uint8_t>& buf)
+{
+    if (!buf.empty() && fwrite(buf.data(), buf.size(), 1, file_) != 1)
+    {
+        ps3eye_debug("recorder: write error\n");
+        return false;
+    }
+    return true;
+}
+
+void capture_recorder::run()
+{
+    using namespace std::chrono;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    while (!exit_signaled_)
+    {
+        cv_.wait_for(lock, milliseconds(250), [this] { return back_full_ || exit_signaled_; });
+
+        // Don't let a slow stream sit in memory for long.
+        if (!back_full_ && !buffers_[front_].empty())
+        {
+            front_ ^= 1;
+            back_full_ = true;
+        }
+
+        if (back_full_)
+        {
+            std::vector<uint8_t>& back = buffers_[front_ ^ 1];
+            lock.unlock();
+            bool ok = write(back);
+            back.clear();
+            lock.lock();
+            back_full_ = false;
+            write_error_ |= !ok;
+        }
+    }
+
+    // The USB side is stopped by now.
+    if (write(buffers_[front_ ^ 1]))
+        write(buffers_[front_]);
+    buffers_[0].clear();
+    buffers_[1].clear();
+    fflush(file_);
+}
+
+} // ns ps3eye::detail
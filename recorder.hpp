@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ps3eye::detail {
+
+// Writes completed bulk transfers to a capture file, see capture_file.
+// append() runs on the USB thread and only copies into the front buffer;
+// a writer thread puts the back buffer on disk. When both are full the
+// transfer is left out rather than stalling the USB thread.
+struct capture_recorder final
+{
+    capture_recorder() = default;
+    ~capture_recorder();
+
+    [[nodiscard]] bool open(const char* path, uint32_t frame_size);
+    void close();
+
+    // False if the transfer couldn't be buffered.
+    bool append(std::chrono::steady_clock::time_point received, const uint8_t* data, int len);
+
+    capture_recorder(const capture_recorder&) = delete;
+    void operator=(const capture_recorder&) = delete;
+
+private:
+    void run();
+    bool write(const std::vector<uint8_t>& buf);
+
+    static constexpr inline unsigned buffer_size = 4 << 20;
+
+    FILE* file_ = nullptr;
+    std::thread thread_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<uint8_t> buffers_[2];
+    unsigned front_ = 0;
+    bool back_full_ = false;
+    bool exit_signaled_ = false;
+    bool write_error_ = false;
+};
+
+} // ns ps3eye::detail
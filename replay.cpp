@@ -0,0 +1,235 @@
+#include "replay.hpp"
+#include "urb.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <libusb.h>
+
+namespace ps3eye::detail {
+
+// See ps3eye.cpp
+enum : uint8_t {
+    OV534_REG_SUBADDR = 0xf2,
+    OV534_REG_WRITE = 0xf3,
+    OV534_REG_READ = 0xf4,
+    OV534_REG_OPERATION = 0xf5,
+    OV534_REG_STATUS = 0xf6,
+    OV534_OP_WRITE_3 = 0x37,
+    OV534_OP_WRITE_2 = 0x33,
+    OV534_OP_READ_2 = 0xf9,
+};
+
+// Larger records can only come from a damaged file.
+static constexpr uint32_t max_record_length = 1 << 24;
+
+bool capture_file::write_header(FILE* f, uint32_t frame_size)
+{
+    return fwrite(magic, sizeof(magic), 1, f) == 1 &&
+           fwrite(&version, sizeof(version), 1, f) == 1 &&
+           fwrite(&frame_size, sizeof(frame_size), 1, f) == 1;
+}
+
+bool capture_file::read_header(FILE* f, uint32_t& frame_size)
+{
+    char magic_[sizeof(magic)];
+    uint32_t version_;
+
+    if (fread(magic_, sizeof(magic_), 1, f) != 1 ||
+        fread(&version_, sizeof(version_), 1, f) != 1 ||
+        fread(&frame_size, sizeof(frame_size), 1, f) != 1)
+        return false;
+
+    return !memcmp(magic_, magic, sizeof(magic)) && version_ == version;
+}
+
+replay_transport::replay_transport(std::string path, replay_rate rate, bool loop) :
+    path_(std::move(path)), rate_(rate), loop_(loop)
+{
+}
+
+replay_transport::~replay_transport()
+{
+    close();
+}
+
+int replay_transport::open()
+{
+    file_ = fopen(path_.c_str(), "rb");
+    if (!file_)
+    {
+        ps3eye_debug("replay: can't open %s\n", path_.c_str());
+        return LIBUSB_ERROR_NOT_FOUND;
+    }
+
+    if (!capture_file::read_header(file_, frame_size_))
+    {
+        ps3eye_debug("replay: %s isn't a capture file\n", path_.c_str());
+        fclose(file_);
+        file_ = nullptr;
+        return LIBUSB_ERROR_IO;
+    }
+    data_start_ = ftell(file_);
+
+    bridge_regs_ = {};
+    reset_sensor();
+
+    return 0;
+}
+
+void replay_transport::close()
+{
+    exit_signaled_ = true;
+    if (thread_.joinable())
+        thread_.join();
+
+    if (file_)
+        fclose(file_);
+    file_ = nullptr;
+}
+
+void replay_transport::reset_sensor()
+{
+    sensor_regs_ = {};
+    // product ID and version of the OV7720
+    sensor_regs_[0x0a] = 0x77;
+    sensor_regs_[0x0b] = 0x21;
+}
+
+int replay_transport::reg_write(uint16_t reg, uint8_t val)
+{
+    if (!file_)
+        return LIBUSB_ERROR_NO_DEVICE;
+    if (reg >= bridge_regs_.size())
+        return 1;
+
+    bridge_regs_[reg] = val;
+
+    // SCCB goes through the bridge: the operation register kicks off the
+    // transfer of the subaddress and data registers. It always succeeds.
+    if (reg == OV534_REG_OPERATION)
+    {
+        uint8_t subaddr = bridge_regs_[OV534_REG_SUBADDR];
+        switch (val)
+        {
+        case OV534_OP_WRITE_3:
+            sensor_regs_[subaddr] = bridge_regs_[OV534_REG_WRITE];
+            if (subaddr == 0x12 && (bridge_regs_[OV534_REG_WRITE] & 0x80))
+                reset_sensor();
+            break;
+        case OV534_OP_READ_2:
+            bridge_regs_[OV534_REG_READ] = sensor_regs_[subaddr];
+            break;
+        default:
+            break;
+        }
+        bridge_regs_[OV534_REG_STATUS] = 0x00;
+    }
+
+    return 1;
+}
+
+int replay_transport::reg_read(uint16_t reg, uint8_t& val)
+{
+    if (!file_)
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    val = reg < bridge_regs_.size() ? bridge_regs_[reg] : 0;
+    return 1;
+}
+
+bool replay_transport::start_stream(urb_descriptor& urb, uint32_t frame_size)
+{
+    if (!file_)
+        return false;
+
+    if (frame_size != frame_size_)
+    {
+        ps3eye_debug("replay: capture has %u byte frames, not %u\n", frame_size_, frame_size);
+        return false;
+    }
+
+    if (fseek(file_, data_start_, SEEK_SET) != 0)
+        return false;
+
+    urb.begin(frame_size);
+
+    exit_signaled_ = false;
+    thread_ = std::thread(&replay_transport::run, this, std::ref(urb));
+
+    return true;
+}
+
+void replay_transport::stop_stream(urb_descriptor&)
+{
+    exit_signaled_ = true;
+    if (thread_.joinable())
+        thread_.join();
+}
+
+bool replay_transport::read_record(std::vector<uint8_t>& payload, uint64_t& timestamp_ns)
+{
+    uint32_t length;
+
+    if (fread(&timestamp_ns, sizeof(timestamp_ns), 1, file_) != 1 ||
+        fread(&length, sizeof(length), 1, file_) != 1 ||
+        length > max_record_length)
+        return false;
+
+    payload.resize(length);
+    return length == 0 || fread(payload.data(), length, 1, file_) == 1;
+}
+
+void replay_transport::run(urb_descriptor& urb)
+{
+    using namespace std::chrono;
+    using clock = steady_clock;
+
+    std::vector<uint8_t> payload;
+    uint64_t timestamp_ns, first_ns = 0;
+    clock::time_point start;
+    bool first = true, fed = false;
+
+    while (!exit_signaled_)
+    {
+        if (!read_record(payload, timestamp_ns))
+        {
+            // Start over, unless the file has nothing to replay at all.
+            if (!loop_ || !fed || fseek(file_, data_start_, SEEK_SET) != 0)
+                break;
+            first = true;
+            fed = false;
+            continue;
+        }
+
+        if (payload.empty())
+            continue;
+
+        if (first)
+        {
+            first_ns = timestamp_ns;
+            start = clock::now();
+            first = false;
+        }
+        else if (rate_ == replay_rate::recorded)
+        {
+            auto due = start + nanoseconds(std::max(timestamp_ns, first_ns) - first_ns);
+            // short naps, so stop() doesn't wait for a long gap
+            for (auto now = clock::now(); now < due && !exit_signaled_; now = clock::now())
+                std::this_thread::sleep_for(std::min<clock::duration>(due - now, milliseconds(50)));
+        }
+
+        urb.transfer_completed(payload.data(), (int)payload.size(), clock::now());
+        fed = true;
+    }
+
+    if (!exit_signaled_)
+        ps3eye_debug("replay: end of %s\n", path_.c_str());
+}
+
+bool replay_transport::port_path(char* buf, unsigned sz) const
+{
+    int len = snprintf(buf, sz, "replay:%s", path_.c_str());
+    return len >= 0 && (unsigned)len < sz;
+}
+
+} // ns ps3eye::detail
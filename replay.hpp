@@ -0,0 +1,68 @@
+#pragma once
+
+#include "transport.hpp"
+#include "internal.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ps3eye::detail {
+
+// Capture file layout, in host byte order:
+//   header: char magic[8] "PS3EYEBT", u32 version, u32 frame_size
+//   records until EOF: u64 timestamp_ns, u32 length, length bytes of payload
+// One record per completed bulk transfer, payload as it came off the bus.
+// Timestamps only matter relative to each other.
+struct capture_file final
+{
+    static constexpr inline char magic[8] = { 'P', 'S', '3', 'E', 'Y', 'E', 'B', 'T' };
+    static constexpr inline uint32_t version = 1;
+    static constexpr inline unsigned header_size = sizeof(magic) + 2 * sizeof(uint32_t);
+    static constexpr inline unsigned record_header_size = sizeof(uint64_t) + sizeof(uint32_t);
+
+    static bool write_header(FILE* f, uint32_t frame_size);
+    static bool read_header(FILE* f, uint32_t& frame_size);
+};
+
+// Stands in for the camera: feeds recorded bulk payloads to the urb and
+// answers control requests from a model of the bridge and sensor registers.
+struct replay_transport final : transport
+{
+    replay_transport(std::string path, replay_rate rate, bool loop);
+    ~replay_transport() override;
+
+    int open() override;
+    void close() override;
+
+    int reg_write(uint16_t reg, uint8_t val) override;
+    int reg_read(uint16_t reg, uint8_t& val) override;
+
+    bool start_stream(urb_descriptor& urb, uint32_t frame_size) override;
+    void stop_stream(urb_descriptor& urb) override;
+
+    bool port_path(char* buf, unsigned sz) const override;
+
+private:
+    void run(urb_descriptor& urb);
+    bool read_record(std::vector<uint8_t>& payload, uint64_t& timestamp_ns);
+    void reset_sensor();
+
+    std::string path_;
+    FILE* file_ = nullptr;
+    long data_start_ = 0;
+    uint32_t frame_size_ = 0;
+    replay_rate rate_;
+    bool loop_;
+
+    std::thread thread_;
+    std::atomic_bool exit_signaled_ = false;
+
+    std::array<uint8_t, 256> bridge_regs_ {};
+    std::array<uint8_t, 256> sensor_regs_ {};
+};
+
+} // ns ps3eye::detail
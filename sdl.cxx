@@ -35,8 +35,7 @@ static void run_camera(ps3eye::resolution res, int fps)
     auto camera = cameras[0];
     bool running = true;
 
-    running &= camera->init(res, fps, ps3eye::fmt_BGR);
-    running &= camera->start();
+    running &= camera->init(res, fps, ps3eye::fmt_BGRA);
 
     if (!running)
     {
@@ -71,7 +70,7 @@ static void run_camera(ps3eye::resolution res, int fps)
     print_renderer_info(renderer);
 
     SDL_Texture* video_tex =
-        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_BGR24, SDL_TEXTUREACCESS_STREAMING,
+        SDL_CreateTexture(renderer, SDL_PIXELFORMAT_BGRA32, SDL_TEXTUREACCESS_STREAMING,
                           camera->width(), camera->height());
 
     if (!video_tex)
@@ -82,6 +81,24 @@ static void run_camera(ps3eye::resolution res, int fps)
         return;
     }
 
+    // write frames straight into the texture, rows and all
+    {
+        void* pixels;
+        int pitch;
+        SDL_LockTexture(video_tex, nullptr, &pixels, &pitch);
+        SDL_UnlockTexture(video_tex);
+        camera->set_stride(pitch);
+    }
+
+    if (!camera->start())
+    {
+        fprintf(stderr, "device start failed\n");
+        SDL_DestroyTexture(video_tex);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        return;
+    }
+
     fprintf(stderr, "camera mode: %dx%d@%dHz\n", w, h, camera->framerate());
 
     SDL_Event e;
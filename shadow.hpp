@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+
+namespace ps3eye::detail {
+
+// Last values written to a bank of 8-bit registers, so that changing a
+// few bits doesn't take a read over USB first. Registers the device
+// changes by itself are never served from it.
+struct register_shadow final
+{
+    bool get(unsigned reg, uint8_t& val) const
+    {
+        if (reg >= size || !known_[reg] || volatile_[reg])
+            return false;
+        val = values_[reg];
+        return true;
+    }
+
+    void set(unsigned reg, uint8_t val)
+    {
+        if (reg >= size)
+            return;
+        values_[reg] = val;
+        known_[reg] = true;
+    }
+
+    void forget(unsigned reg)
+    {
+        if (reg < size)
+            known_[reg] = false;
+    }
+
+    void clear() { known_.reset(); }
+
+    void set_volatile(unsigned reg)
+    {
+        if (reg < size)
+            volatile_[reg] = true;
+    }
+
+private:
+    static constexpr unsigned size = 256;
+
+    std::array<uint8_t, size> values_ {};
+    std::bitset<size> known_, volatile_;
+};
+
+} // ns ps3eye::detail
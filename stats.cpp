@@ -0,0 +1,50 @@
+#include "stats.hpp"
+
+#include <initializer_list>
+
+namespace ps3eye::detail {
+
+void capture_counters::reset()
+{
+    for (counter* c : { &bytes_received, &transfers_completed, &transfer_errors,
+                        &transfers_unrecorded,
+                        &payloads_bad_header, &payloads_error, &payloads_no_pts,
+                        &frames_completed, &frames_incomplete, &frames_overwritten,
+                        &frames_evicted, &frames_skipped, &frames_delivered,
+                        &producer_stalls, &get_frame_timeouts })
+        c->store(0, std::memory_order_relaxed);
+}
+
+capture_stats capture_counters::snapshot() const
+{
+    constexpr auto relaxed = std::memory_order_relaxed;
+    capture_stats ret;
+
+    ret.bytes_received = bytes_received.load(relaxed);
+    ret.transfers_completed = transfers_completed.load(relaxed);
+    ret.transfer_errors = transfer_errors.load(relaxed);
+    ret.transfers_unrecorded = transfers_unrecorded.load(relaxed);
+
+    ret.payloads_bad_header = payloads_bad_header.load(relaxed);
+    ret.payloads_error = payloads_error.load(relaxed);
+    ret.payloads_no_pts = payloads_no_pts.load(relaxed);
+
+    ret.frames_completed = frames_completed.load(relaxed);
+    ret.frames_incomplete = frames_incomplete.load(relaxed);
+    ret.frames_overwritten = frames_overwritten.load(relaxed);
+    ret.frames_evicted = frames_evicted.load(relaxed);
+    ret.frames_skipped = frames_skipped.load(relaxed);
+    ret.frames_delivered = frames_delivered.load(relaxed);
+    ret.frames_dropped = ret.frames_incomplete + ret.frames_overwritten +
+                         ret.frames_evicted + ret.frames_skipped;
+    ret.producer_stalls = producer_stalls.load(relaxed);
+    ret.policy = policy;
+    ret.transfer_count = transfer_count;
+    ret.transfer_size = transfer_size;
+
+    ret.get_frame_timeouts = get_frame_timeouts.load(relaxed);
+
+    return ret;
+}
+
+} // ns ps3eye::detail
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "internal.hpp"
+
+#include <atomic>
+#include <cstdint>
+
+namespace ps3eye::detail {
+
+// Live counters behind capture_stats. Each counter has a single writer,
+// either the USB thread or the consumer, so bumping it doesn't need a
+// locked read-modify-write. Readers may see a snapshot mid-update.
+struct capture_counters final
+{
+    using counter = std::atomic<uint64_t>;
+
+    static void bump(counter& c, uint64_t n = 1)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void reset();
+    capture_stats snapshot() const;
+
+    counter bytes_received = 0;
+    counter transfers_completed = 0;
+    counter transfer_errors = 0;
+    counter transfers_unrecorded = 0;
+
+    counter payloads_bad_header = 0;
+    counter payloads_error = 0;
+    counter payloads_no_pts = 0;
+
+    counter frames_completed = 0;
+    counter frames_incomplete = 0;
+    counter frames_overwritten = 0;
+    counter frames_evicted = 0;
+    counter frames_skipped = 0;
+    counter frames_delivered = 0;
+    counter producer_stalls = 0;
+
+    counter get_frame_timeouts = 0;
+
+    // Not counters, set only while stopped.
+    drop_policy policy = drop_policy::drop_newest;
+    uint32_t transfer_count = 0;
+    uint32_t transfer_size = 0;
+};
+
+} // ns ps3eye::detail
@@ -0,0 +1,259 @@
+#include "transport.hpp"
+#include "urb.hpp"
+#include "mgr.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <libusb.h>
+
+namespace ps3eye::detail {
+
+transport::~transport() = default;
+
+int transport::reg_write_array(const uint8_t (*data)[2], unsigned len)
+{
+    for (unsigned i = 0; i < len; i++)
+        if (int ret = reg_write(data[i][0], data[i][1]); ret < 0)
+            return ret;
+    return (int)len;
+}
+
+libusb_transport::libusb_transport(libusb_device* device) : device_(device)
+{
+}
+
+libusb_transport::~libusb_transport()
+{
+    close();
+    if (device_)
+        libusb_unref_device(device_);
+}
+
+int libusb_transport::open()
+{
+    // The device has to be opened in the context whose thread will
+    // handle its transfers.
+    loop_ = &usb_manager::instance().attach();
+    loop_device_ = loop_->find(device_);
+    if (!loop_device_)
+    {
+        ps3eye_debug("device vanished\n");
+        return LIBUSB_ERROR_NO_DEVICE;
+    }
+
+    // open, set first config and claim interface
+    int res = libusb_open(loop_device_, &handle_);
+    if (res != 0)
+    {
+        ps3eye_debug("device open error: %d\n", res);
+        handle_ = nullptr;
+        return res;
+    }
+
+    // Linux has a kernel module for the PS3 eye camera (that's where most of
+    // the code in here comes from..) so we must detach the driver before we can
+    // hook up with the eye ourselves
+    libusb_detach_kernel_driver(handle_, 0);
+
+    // libusb_set_configuration(handle_, 0);
+
+    res = libusb_claim_interface(handle_, 0);
+    if (res != 0)
+    {
+        ps3eye_debug("device claim interface error: %d\n", res);
+        return res;
+    }
+
+    return 0;
+}
+
+void libusb_transport::close()
+{
+    if (handle_)
+    {
+        libusb_release_interface(handle_, 0);
+        libusb_attach_kernel_driver(handle_, 0);
+        libusb_close(handle_);
+        handle_ = nullptr;
+    }
+
+    if (loop_device_)
+        libusb_unref_device(loop_device_);
+    loop_device_ = nullptr;
+
+    if (loop_)
+        usb_manager::instance().detach(*loop_);
+    loop_ = nullptr;
+}
+
+int libusb_transport::reg_write(uint16_t reg, uint8_t val)
+{
+    // debug("reg=0x%04x, val=0%02x", reg, val);
+    usb_buf[0] = val;
+
+    return libusb_control_transfer(handle_, LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+                                   0x01, 0x00, reg, usb_buf.data(), 1, 500);
+}
+
+int libusb_transport::reg_read(uint16_t reg, uint8_t& val)
+{
+    int ret = libusb_control_transfer(handle_, LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+                                      0x01, 0x00, reg, usb_buf.data(), 1, 500);
+
+    // debug("reg=0x%04x, data=0x%02x", reg, usb_buf[0]);
+    val = ret < 0 ? 0 : usb_buf[0];
+    return ret;
+}
+
+namespace {
+
+// Callbacks may run on the event thread while transfers are still being
+// submitted here, so the submitter holds a reference of its own.
+struct write_batch
+{
+    std::atomic_int pending = 1;
+    int completed = 0;
+    int error = 0;
+};
+
+} // namespace
+
+static void LIBUSB_CALL write_batch_callback(libusb_transfer* xfr)
+{
+    write_batch& batch = *static_cast<write_batch*>(xfr->user_data);
+
+    switch (xfr->status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED:
+        break;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        batch.error = LIBUSB_ERROR_TIMEOUT;
+        break;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        batch.error = LIBUSB_ERROR_NO_DEVICE;
+        break;
+    case LIBUSB_TRANSFER_STALL:
+        batch.error = LIBUSB_ERROR_PIPE;
+        break;
+    default:
+        batch.error = LIBUSB_ERROR_IO;
+        break;
+    }
+
+    if (batch.pending.fetch_sub(1) == 1)
+        batch.completed = 1;
+}
+
+// Control transfers to the same endpoint complete in the order submitted,
+// so the bridge sees the same writes as from reg_write() one at a time,
+// without waiting a round trip for each.
+int libusb_transport::reg_write_array(const uint8_t (*data)[2], unsigned len)
+{
+    constexpr unsigned max_batch = 32;
+    constexpr unsigned setup_size = LIBUSB_CONTROL_SETUP_SIZE;
+    uint8_t buffers[max_batch][setup_size + 1];
+    libusb_transfer* xfr[max_batch] {};
+
+    for (unsigned pos = 0; pos < len; pos += max_batch)
+    {
+        const unsigned n = std::min(len - pos, max_batch);
+        write_batch batch;
+
+        for (unsigned i = 0; i < n; i++)
+        {
+            xfr[i] = libusb_alloc_transfer(0);
+            if (!xfr[i])
+            {
+                batch.error = LIBUSB_ERROR_NO_MEM;
+                break;
+            }
+            libusb_fill_control_setup(buffers[i], LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+                                      0x01, 0x00, data[pos + i][0], 1);
+            buffers[i][setup_size] = data[pos + i][1];
+            libusb_fill_control_transfer(xfr[i], handle_, buffers[i], write_batch_callback, &batch, 500);
+
+            batch.pending++;
+            if (int ret = libusb_submit_transfer(xfr[i]); ret < 0)
+            {
+                batch.pending--;
+                batch.error = ret;
+                break;
+            }
+        }
+
+        if (batch.pending.fetch_sub(1) == 1)
+            batch.completed = 1;
+        while (!batch.completed)
+        {
+            struct timeval tv { 0, 100 * 1000 /* ms */ };
+            libusb_handle_events_timeout_completed(loop_->context(), &tv, &batch.completed);
+        }
+
+        for (libusb_transfer*& x : xfr)
+        {
+            libusb_free_transfer(x);
+            x = nullptr;
+        }
+
+        if (batch.error < 0)
+            return batch.error;
+    }
+
+    return (int)len;
+}
+
+bool libusb_transport::start_stream(urb_descriptor& urb, uint32_t frame_size)
+{
+    if (!urb.start_transfers(handle_, *loop_, frame_size))
+        ps3eye_debug("error submitting transfers\n");
+    return true;
+}
+
+void libusb_transport::stop_stream(urb_descriptor& urb)
+{
+    urb.close_transfers();
+}
+
+#define MAX_USB_DEVICE_PORT_PATH 7
+
+bool libusb_transport::port_path(char* buf, unsigned sz) const
+{
+    bool success = false;
+    uint8_t port_numbers[MAX_USB_DEVICE_PORT_PATH];
+
+    memset(buf, 0, sz);
+    memset(port_numbers, 0, sizeof(port_numbers));
+
+    int cnt = libusb_get_port_numbers(device_, port_numbers, MAX_USB_DEVICE_PORT_PATH);
+    int bus_id = libusb_get_bus_number(device_);
+
+    snprintf(buf, sz, "b%d", bus_id);
+
+    if (cnt > 0)
+    {
+        success = true;
+
+        for (int i = 0; i < cnt; i++)
+        {
+            uint8_t port_number = port_numbers[i];
+            char port_string[8];
+
+            snprintf(port_string, sizeof(port_string),
+                     (i == 0) ? "_p%d" : ".%d", port_number);
+
+            if (strlen(buf) + strlen(port_string) + 1 <= sz)
+                std::strcat(buf, port_string);
+            else
+            {
+                success = false;
+                break;
+            }
+        }
+    }
+
+    return success;
+}
+
+} // ns ps3eye::detail
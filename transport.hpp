@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+struct libusb_device;
+struct libusb_device_handle;
+
+namespace ps3eye::detail {
+
+struct urb_descriptor;
+struct event_loop;
+
+// Everything camera needs from the bus. Errors are libusb error codes so
+// that camera::error_string() works the same for every transport.
+struct transport
+{
+    virtual ~transport();
+
+    [[nodiscard]] virtual int open() = 0;
+    virtual void close() = 0;
+
+    // Vendor control requests to the OV534 bridge. Return < 0 on error.
+    virtual int reg_write(uint16_t reg, uint8_t val) = 0;
+    virtual int reg_read(uint16_t reg, uint8_t& val) = 0;
+    // Several writes in order, pipelined where the transport can.
+    virtual int reg_write_array(const uint8_t (*data)[2], unsigned len);
+
+    // Start feeding payloads into urb.pkt_scan(), until stop_stream().
+    [[nodiscard]] virtual bool start_stream(urb_descriptor& urb, uint32_t frame_size) = 0;
+    virtual void stop_stream(urb_descriptor& urb) = 0;
+
+    [[nodiscard]] virtual bool port_path(char* buf, unsigned sz) const = 0;
+    virtual libusb_device* device() const { return nullptr; }
+};
+
+// Takes over the reference to `device`.
+struct libusb_transport final : transport
+{
+    explicit libusb_transport(libusb_device* device);
+    ~libusb_transport() override;
+
+    int open() override;
+    void close() override;
+
+    int reg_write(uint16_t reg, uint8_t val) override;
+    int reg_read(uint16_t reg, uint8_t& val) override;
+    int reg_write_array(const uint8_t (*data)[2], unsigned len) override;
+
+    bool start_stream(urb_descriptor& urb, uint32_t frame_size) override;
+    void stop_stream(urb_descriptor& urb) override;
+
+    bool port_path(char* buf, unsigned sz) const override;
+    libusb_device* device() const override { return device_; }
+
+private:
+    libusb_device* device_ = nullptr;
+    // device_ as seen from the event loop's context, while open
+    libusb_device* loop_device_ = nullptr;
+    event_loop* loop_ = nullptr;
+    libusb_device_handle* handle_ = nullptr;
+    std::array<uint8_t, 64> usb_buf {};
+};
+
+} // ns ps3eye::detail
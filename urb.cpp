@@ -24,6 +24,7 @@ urb_descriptor::urb_descriptor() = default;
 static void LIBUSB_CALL transfer_completed_callback(struct libusb_transfer* xfr)
 {
     urb_descriptor* urb = reinterpret_cast<urb_descriptor*>(xfr->user_data);
+    capture_counters& counters = urb->queue.counters();
     enum libusb_transfer_status status = xfr->status;
 
     if (status != LIBUSB_TRANSFER_COMPLETED)
@@ -32,6 +33,7 @@ static void LIBUSB_CALL transfer_completed_callback(struct libusb_transfer* xfr)
 
         if (status != LIBUSB_TRANSFER_CANCELLED)
         {
+            capture_counters::bump(counters.transfer_errors);
             ps3eye_debug("transfer status %d\n", status);
             urb->close_transfers();
         }
@@ -39,11 +41,11 @@ static void LIBUSB_CALL transfer_completed_callback(struct libusb_transfer* xfr)
     }
 
     // debug("length:%u, actual_length:%u\n", xfr->length, xfr->actual_length);
-
-    urb->pkt_scan(xfr->buffer, xfr->actual_length);
+    urb->transfer_completed(xfr->buffer, xfr->actual_length, std::chrono::steady_clock::now());
 
     if (libusb_submit_transfer(xfr) < 0)
     {
+        capture_counters::bump(counters.transfer_errors);
         ps3eye_debug("error re-submitting URB\n");
         urb->close_transfers();
     }
@@ -93,7 +95,7 @@ static uint8_t find_ep(struct libusb_device* device)
     return ep_addr;
 }
 
-bool urb_descriptor::start_transfers(libusb_device_handle* handle, uint32_t frame_size_)
+void urb_descriptor::begin(uint32_t frame_size_)
 {
     // Initialize the frame queue
     frame_size = frame_size_;
@@ -104,12 +106,75 @@ bool urb_descriptor::start_transfers(libusb_device_handle* handle, uint32_t fram
     cur_frame_start = queue.buffer();
     frame_data_len = 0;
 
+    last_pts = 0;
+    last_fid = 0;
+    last_packet_type = DISCARD_PACKET;
+}
+
+void urb_descriptor::configure_transfers(unsigned count, unsigned size, uint32_t frame_size_, int fps)
+{
+    // Bytes on the wire per frame, with the 12-byte payload headers.
+    const uint64_t frame_bytes = (frame_size_ + payload_size - 13) / (payload_size - 12) * payload_size;
+    fps = std::max(fps, 1);
+
+    if (size == 0)
+    {
+        // About 2 ms worth of data. A frame ends in a short payload, which
+        // completes its transfer early, so bigger ones mostly save
+        // callbacks; smaller ones smooth out the USB thread's work.
+        const uint64_t rate = frame_bytes * (unsigned)fps;
+        size = (unsigned)std::clamp<uint64_t>(rate / 500, 16384, default_transfer_size);
+    }
+    size = std::clamp((size + payload_size - 1) / payload_size * payload_size, payload_size, max_transfer_size);
+
+    if (count == 0)
+    {
+        // One frame in flight up to 60 fps, then one more per 60 fps,
+        // so that 187 and 290 fps ride out a late USB thread as well.
+        const uint64_t frames = std::clamp(fps / 60, 1, 4);
+        count = (unsigned)((frames * frame_bytes + size - 1) / size);
+    }
+    count = std::clamp(count, 2u, max_transfers);
+
+    num_transfers = count;
+    transfer_size = size;
+}
+
+bool urb_descriptor::start_transfers(libusb_device_handle* handle, event_loop& events_, uint32_t frame_size_)
+{
+    begin(frame_size_);
+
+    capture_counters& counters = queue.counters();
+    counters.transfer_count = num_transfers;
+    counters.transfer_size = transfer_size;
+
     // Find the bulk transfer endpoint
     uint8_t bulk_endpoint = find_ep(libusb_get_device(handle));
     libusb_clear_halt(handle, bulk_endpoint);
 
-    // Allocate the transfer buffer
-    memset(transfer_buffer.data(), 0, transfer_size * num_transfers);
+    // Have the host controller write into our buffers directly; with
+    // plain user memory, usbfs reads into a kernel buffer and copies it
+    // over when the transfer is reaped. Not available everywhere.
+    uint8_t* buffers = nullptr;
+#if defined LIBUSB_API_VERSION && LIBUSB_API_VERSION >= 0x01000105
+    dev_mem = libusb_dev_mem_alloc(handle, transfer_size * num_transfers);
+    if (dev_mem)
+    {
+        dev_mem_handle = handle;
+        buffers = dev_mem;
+    }
+    else
+        ps3eye_debug("no device memory, using user buffers\n");
+#endif
+    if (!buffers)
+    {
+        if (transfer_buffer_size < transfer_size * num_transfers)
+        {
+            transfer_buffer_size = transfer_size * num_transfers;
+            transfer_buffer = std::make_unique<uint8_t[]>(transfer_buffer_size);
+        }
+        buffers = transfer_buffer.get();
+    }
 
     int res = 0;
     for (unsigned i = 0; i < num_transfers; ++i)
@@ -117,7 +182,7 @@ bool urb_descriptor::start_transfers(libusb_device_handle* handle, uint32_t fram
         // Create & submit the transfer
         xfr[i] = libusb_alloc_transfer(0);
         libusb_fill_bulk_transfer(xfr[i], handle, bulk_endpoint,
-                                  transfer_buffer.data() + i * transfer_size, transfer_size, transfer_completed_callback,
+                                  buffers + i * transfer_size, transfer_size, transfer_completed_callback,
                                   reinterpret_cast<void*>(this), 0);
 
         res |= libusb_submit_transfer(xfr[i]);
@@ -125,10 +190,8 @@ bool urb_descriptor::start_transfers(libusb_device_handle* handle, uint32_t fram
         num_active_transfers++;
     }
 
-    last_pts = 0;
-    last_fid = 0;
-
-    usb_manager::instance().camera_started();
+    events = &events_;
+    events->camera_started();
 
     return res == 0;
 }
@@ -136,7 +199,13 @@ bool urb_descriptor::start_transfers(libusb_device_handle* handle, uint32_t fram
 void urb_descriptor::close_transfers()
 {
     std::unique_lock<std::mutex> lock(num_active_transfers_mutex);
-    if (num_active_transfers == 0) return;
+    // Every transfer may already have failed; what they used still has
+    // to go.
+    if (num_active_transfers == 0)
+    {
+        free_transfers();
+        return;
+    }
 
     // Cancel any pending transfers
     for (unsigned i = 0; i < num_transfers; ++i)
@@ -147,6 +216,14 @@ void urb_descriptor::close_transfers()
         return num_active_transfers == 0;
     });
 
+    free_transfers();
+
+    events->camera_stopped();
+    events = nullptr;
+}
+
+void urb_descriptor::free_transfers()
+{
     // Free completed transfers
     for (unsigned i = 0; i < num_transfers; ++i)
     {
@@ -157,7 +234,12 @@ void urb_descriptor::close_transfers()
         xfr[i] = nullptr;
     }
 
-    usb_manager::instance().camera_stopped();
+#if defined LIBUSB_API_VERSION && LIBUSB_API_VERSION >= 0x01000105
+    if (dev_mem)
+        libusb_dev_mem_free(dev_mem_handle, dev_mem, transfer_size * num_transfers);
+#endif
+    dev_mem = nullptr;
+    dev_mem_handle = nullptr;
 }
 
 void urb_descriptor::transfer_cancelled()
@@ -172,6 +254,8 @@ void urb_descriptor::frame_add(enum gspca_packet_type packet_type, const uint8_t
     if (packet_type == FIRST_PACKET)
     {
         frame_data_len = 0;
+        cur_frame_meta.pts = last_pts;
+        cur_frame_meta.first_payload = cur_received;
     }
     else
     {
@@ -187,6 +271,9 @@ void urb_descriptor::frame_add(enum gspca_packet_type packet_type, const uint8_t
         case LAST_PACKET:
             return;
         default:
+            // a frame was in progress
+            if (packet_type == DISCARD_PACKET)
+                capture_counters::bump(queue.counters().frames_incomplete);
             break;
         }
     }
@@ -196,6 +283,7 @@ void urb_descriptor::frame_add(enum gspca_packet_type packet_type, const uint8_t
     {
         if (frame_data_len + (unsigned)len > frame_size)
         {
+            capture_counters::bump(queue.counters().frames_incomplete);
             packet_type = DISCARD_PACKET;
             frame_data_len = 0;
         }
@@ -211,13 +299,30 @@ void urb_descriptor::frame_add(enum gspca_packet_type packet_type, const uint8_t
     if (packet_type == LAST_PACKET)
     {
         frame_data_len = 0;
-        cur_frame_start = queue.enqueue();
+        cur_frame_meta.timestamp = cur_received;
+        cur_frame_start = queue.enqueue(cur_frame_meta);
         // debug("frame completed %d\n", frame_complete_ind);
     }
 }
 
-void urb_descriptor::pkt_scan(uint8_t* data, int len)
+void urb_descriptor::transfer_completed(uint8_t* data, int len, std::chrono::steady_clock::time_point received)
+{
+    capture_counters& counters = queue.counters();
+    capture_counters::bump(counters.transfers_completed);
+    capture_counters::bump(counters.bytes_received, (unsigned)len);
+
+    if (recorder && !recorder->append(received, data, len))
+        capture_counters::bump(counters.transfers_unrecorded);
+
+    pkt_scan(data, len, received);
+}
+
+void urb_descriptor::pkt_scan(uint8_t* data, int len, std::chrono::steady_clock::time_point received)
 {
+    // Payloads only reach us a whole transfer at a time, so they all share
+    // the transfer's completion time.
+    cur_received = received;
+
     uint32_t this_pts;
     uint16_t this_fid;
     int remaining_len = len;
@@ -236,6 +341,7 @@ void urb_descriptor::pkt_scan(uint8_t* data, int len)
         /* Verify UVC header.  Header length is always 12 */
         if (data[0] != 12 || len < 12)
         {
+            capture_counters::bump(queue.counters().payloads_bad_header);
             ps3eye_debug("bad header\n");
             goto discard;
         }
@@ -243,6 +349,7 @@ void urb_descriptor::pkt_scan(uint8_t* data, int len)
         /* Check errors */
         if (data[1] & UVC_STREAM_ERR)
         {
+            capture_counters::bump(queue.counters().payloads_error);
             ps3eye_debug("payload error\n");
             goto discard;
         }
@@ -250,6 +357,7 @@ void urb_descriptor::pkt_scan(uint8_t* data, int len)
         /* Extract PTS and FID */
         if (!(data[1] & UVC_STREAM_PTS))
         {
+            capture_counters::bump(queue.counters().payloads_no_pts);
             ps3eye_debug("PTS not present\n");
             goto discard;
         }
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "queue.hpp"
+#include "recorder.hpp"
 #include "internal.hpp"
 
+#include <memory>
 #include <mutex>
 #include <condition_variable>
 
@@ -11,6 +13,8 @@ struct libusb_transfer;
 
 namespace ps3eye::detail {
 
+struct event_loop;
+
 /* packet types when moving from iso buf to frame buf */
 enum gspca_packet_type : uint8_t
 {
@@ -27,21 +31,44 @@ struct urb_descriptor final
     urb_descriptor();
     ~urb_descriptor();
 
-    bool start_transfers(libusb_device_handle* handle, uint32_t frame_size);
+    // Reset the queue and the parser for a new stream.
+    void begin(uint32_t frame_size);
+    // Set num_transfers and transfer_size for the next start_transfers().
+    // 0 derives them from the data rate: about one frame in flight at
+    // normal rates, up to four at the highest.
+    void configure_transfers(unsigned count, unsigned size, uint32_t frame_size, int fps);
+    bool start_transfers(libusb_device_handle* handle, event_loop& events, uint32_t frame_size);
     void close_transfers();
+    // Free the transfers and their buffers; none may be active.
+    void free_transfers();
     void transfer_cancelled();
     void frame_add(enum gspca_packet_type packet_type, const uint8_t* data, int len);
-    void pkt_scan(uint8_t* data, int len);
+    void pkt_scan(uint8_t* data, int len, std::chrono::steady_clock::time_point received);
+    // A bulk transfer's worth of payloads arrived.
+    void transfer_completed(uint8_t* data, int len, std::chrono::steady_clock::time_point received);
+
+    // Transfers hold whole 2048-byte bulk payloads.
+    static constexpr inline unsigned payload_size = 2048;
+    static constexpr inline unsigned max_transfers = 32;
+    static constexpr inline unsigned max_transfer_size = 1 << 20;
+    static constexpr inline unsigned default_transfer_size = 65536;
 
-    static constexpr inline unsigned num_transfers = 5;
-    static constexpr inline unsigned transfer_size = 65536;
+    // Only changed while no transfers are active.
+    unsigned num_transfers = 5;
+    unsigned transfer_size = default_transfer_size;
 
     std::mutex num_active_transfers_mutex;
     std::condition_variable num_active_transfers_condition;
 
-    libusb_transfer* xfr[num_transfers] {};
+    libusb_transfer* xfr[max_transfers] {};
+    // handling the transfers, while any are active
+    event_loop* events = nullptr;
     frame_queue queue;
+    // Only set or cleared while no transfers are active.
+    std::unique_ptr<capture_recorder> recorder;
     uint8_t* cur_frame_start = nullptr;
+    frame_metadata cur_frame_meta;
+    std::chrono::steady_clock::time_point cur_received;
 
     uint32_t frame_data_len = 0;
     uint32_t frame_size = 0;
@@ -49,7 +76,12 @@ struct urb_descriptor final
     uint16_t last_fid = 0;
     gspca_packet_type last_packet_type = DISCARD_PACKET;
     uint8_t num_active_transfers = 0;
-    std::array<uint8_t, transfer_size * num_transfers> transfer_buffer {};
+    // Transfers land in dev_mem if it could be allocated, else in
+    // transfer_buffer, which is only allocated then.
+    uint8_t* dev_mem = nullptr;
+    libusb_device_handle* dev_mem_handle = nullptr;
+    std::unique_ptr<uint8_t[]> transfer_buffer;
+    size_t transfer_buffer_size = 0;
 };
 
 } // ns ps3eye::detail